@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define COML_IMPLEMENTATION
+#include "coml.h"
+
+#define BENCH_TABLES 1000
+#define BENCH_KEYS 100
+#define BENCH_JSON_ROUNDS 20
+
+static double now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec*1e-9;
+}
+
+static void report(const char* name, size_t count, double seconds) {
+    printf("%-24s %8zu ops %10.2f ms %8.1f ns/op\n", name, count, seconds*1e3, seconds*1e9/(double)count);
+}
+
+// Builds a document with BENCH_TABLES*BENCH_KEYS keys from scratch, then removes everything again
+static bool bench_build(void) {
+    Coml* coml = coml_new(NULL);
+    if (coml == NULL) return false;
+
+    char table_name[32];
+    char key_name[32];
+    size_t count = (size_t)BENCH_TABLES*BENCH_KEYS;
+
+    double start = now();
+    for (size_t i = 0; i < BENCH_TABLES; ++i) {
+        snprintf(table_name, sizeof(table_name), "server.table_%zu", i);
+        for (size_t j = 0; j < BENCH_KEYS; ++j) {
+            snprintf(key_name, sizeof(key_name), "key_%zu", j);
+            bool res = j%2 == 0 ? coml_add_int(coml, (int)j, table_name, key_name) : coml_add_string(coml, key_name, table_name, key_name);
+            if (!res) return false;
+        }
+    }
+    report("coml_add_*", count, now()-start);
+
+    start = now();
+    for (size_t i = 0; i < BENCH_TABLES; ++i) {
+        snprintf(table_name, sizeof(table_name), "server.table_%zu", i);
+        for (size_t j = 0; j < BENCH_KEYS; j += 2) {
+            snprintf(key_name, sizeof(key_name), "key_%zu", j);
+            if (coml_get_value_int(coml, table_name, key_name) != (int)j) return false;
+        }
+    }
+    report("coml_get_value_int", count/2, now()-start);
+
+    start = now();
+    for (size_t i = 0; i < BENCH_TABLES; ++i) {
+        snprintf(table_name, sizeof(table_name), "server.table_%zu", i);
+        for (size_t j = 0; j < BENCH_KEYS; ++j) {
+            snprintf(key_name, sizeof(key_name), "key_%zu", j);
+            if (!coml_remove_key(coml, table_name, key_name)) return false;
+        }
+    }
+    report("coml_remove_key", count, now()-start);
+
+    start = now();
+    for (size_t i = 0; i < BENCH_TABLES; ++i) {
+        snprintf(table_name, sizeof(table_name), "server.table_%zu", i);
+        if (!coml_remove_table(coml, table_name)) return false;
+    }
+    report("coml_remove_table", BENCH_TABLES, now()-start);
+
+    coml_free(coml);
+
+    return true;
+}
+
+static void report_throughput(const char* name, size_t bytes, double seconds) {
+    printf("%-24s %8.2f MB %10.2f ms %8.1f MB/s\n", name, (double)bytes/1e6, seconds*1e3, (double)bytes/1e6/seconds);
+}
+
+// A document with BENCH_TABLES tables of BENCH_KEYS mixed keys, returns NULL if failed
+static char* bench_document(size_t* length) {
+    size_t capacity = (size_t)BENCH_TABLES*BENCH_KEYS*64;
+    char* content = malloc(capacity);
+    if (content == NULL) return NULL;
+
+    size_t used = 0;
+    for (size_t i = 0; i < BENCH_TABLES; ++i) {
+        used += (size_t)snprintf(content+used, capacity-used, "[server.table_%zu]\n", i);
+        for (size_t j = 0; j < BENCH_KEYS; ++j) {
+            switch (j%4) {
+                case 0: used += (size_t)snprintf(content+used, capacity-used, "key_%zu = %zu\n", j, i*j); break;
+                case 1: used += (size_t)snprintf(content+used, capacity-used, "key_%zu = \"value %zu\"\n", j, j); break;
+                case 2: used += (size_t)snprintf(content+used, capacity-used, "key_%zu = %zu.25\n", j, j); break;
+                default: used += (size_t)snprintf(content+used, capacity-used, "key_%zu = [ 1, 2, 3 ]\n", j); break;
+            }
+        }
+    }
+
+    *length = used;
+    return content;
+}
+
+// Counts the bytes in use through an allocator and remembers the most at once
+typedef struct {
+    size_t used;
+    size_t peak;
+} Bench_Memory;
+
+static void* bench_alloc(void* context, size_t size) {
+    Bench_Memory* memory = (Bench_Memory*)context;
+    memory->used += size;
+    if (memory->used > memory->peak) memory->peak = memory->used;
+    return malloc(size);
+}
+
+static void* bench_realloc(void* context, void* ptr, size_t old_size, size_t new_size) {
+    Bench_Memory* memory = (Bench_Memory*)context;
+    memory->used += new_size-old_size;
+    if (memory->used > memory->peak) memory->peak = memory->used;
+    return realloc(ptr, new_size);
+}
+
+static void bench_free(void* context, void* ptr, size_t size) {
+    Bench_Memory* memory = (Bench_Memory*)context;
+    memory->used -= size;
+    free(ptr);
+}
+
+// Streams TOML to JSON without a tree, compared with building the tree and writing it, then reads the JSON back
+static bool bench_json(void) {
+    size_t length = 0;
+    char* content = bench_document(&length);
+    FILE* output = tmpfile();
+    if (content == NULL || output == NULL) return false;
+
+    Bench_Memory tree_memory = { 0, 0 };
+    Coml_Allocator tree_allocator = { bench_alloc, bench_realloc, bench_free, &tree_memory };
+    Coml_Options tree_options = { &tree_allocator, false, NULL };
+
+    double start = now();
+    for (size_t i = 0; i < BENCH_JSON_ROUNDS; ++i) {
+        rewind(output);
+        Coml* coml = coml_parse_ex(content, length, &tree_options, NULL);
+        if (coml == NULL || !coml_write_json(coml, output)) return false;
+        coml_free(coml);
+    }
+    report_throughput("coml_parse_ex+write_json", length*BENCH_JSON_ROUNDS, now()-start);
+
+    Bench_Memory stream_memory = { 0, 0 };
+    Coml_Allocator stream_allocator = { bench_alloc, bench_realloc, bench_free, &stream_memory };
+    Coml_Options stream_options = { &stream_allocator, false, NULL };
+
+    start = now();
+    for (size_t i = 0; i < BENCH_JSON_ROUNDS; ++i) {
+        rewind(output);
+        if (!coml_toml_to_json(content, length, output, &stream_options, NULL)) return false;
+    }
+    report_throughput("coml_toml_to_json", length*BENCH_JSON_ROUNDS, now()-start);
+    printf("%-24s %8.2f MB tree %8.2f MB streamed\n", "peak memory", (double)tree_memory.peak/1e6, (double)stream_memory.peak/1e6);
+
+    long json_length = ftell(output);
+    char* json = json_length > 0 ? malloc((size_t)json_length) : NULL;
+    rewind(output);
+    if (json == NULL || fread(json, 1, (size_t)json_length, output) != (size_t)json_length) return false;
+
+    start = now();
+    for (size_t i = 0; i < BENCH_JSON_ROUNDS; ++i) {
+        Coml* coml = coml_from_json(json, (size_t)json_length, NULL, NULL);
+        if (coml == NULL) return false;
+        coml_free(coml);
+    }
+    report_throughput("coml_from_json", (size_t)json_length*BENCH_JSON_ROUNDS, now()-start);
+
+    free(json);
+    free(content);
+    fclose(output);
+
+    return true;
+}
+
+// Every key_0 through one query, compared with a lookup per table
+static bool bench_query(void) {
+    size_t length = 0;
+    char* content = bench_document(&length);
+    if (content == NULL) return false;
+
+    Coml* coml = coml_parse_ex(content, length, NULL, NULL);
+    free(content);
+    if (coml == NULL) return false;
+
+    char table_name[32];
+    size_t found = 0;
+    double start = now();
+    for (size_t i = 0; i < BENCH_TABLES; ++i) {
+        snprintf(table_name, sizeof(table_name), "server.table_%zu", i);
+        if (coml_get_kv(coml, table_name, "key_0") != NULL) ++found;
+    }
+    report("coml_get_kv per table", BENCH_TABLES, now()-start);
+
+    Coml_Query query;
+    start = now();
+    if (!coml_query(coml, "server.*.key_0", &query)) return false;
+    while (coml_query_next(&query)) --found;
+    coml_query_free(&query);
+    report("coml_query", BENCH_TABLES, now()-start);
+
+    coml_free(coml);
+
+    return found == 0;
+}
+
+// Attaching to an image compared with parsing, and lookups in both
+static bool bench_image(void) {
+    size_t length = 0;
+    char* content = bench_document(&length);
+    if (content == NULL) return false;
+
+    double start = now();
+    Coml* coml = coml_parse_ex(content, length, NULL, NULL);
+    report("coml_parse_ex", 1, now()-start);
+    free(content);
+    if (coml == NULL) return false;
+
+    size_t size = coml_image_size(coml);
+    void* buffer = malloc(size);
+    if (buffer == NULL || !coml_image_write(coml, buffer, size)) return false;
+
+    Coml_Image image;
+    start = now();
+    if (!coml_image_open(&image, buffer, size)) return false;
+    report("coml_image_open", 1, now()-start);
+
+    char table_name[32];
+    start = now();
+    for (size_t i = 0; i < BENCH_TABLES; ++i) {
+        snprintf(table_name, sizeof(table_name), "server.table_%zu", i);
+        if (coml_get_value_int(coml, table_name, "key_4") != (int)(i*4)) return false;
+    }
+    report("coml_get_value_int", BENCH_TABLES, now()-start);
+
+    start = now();
+    for (size_t i = 0; i < BENCH_TABLES; ++i) {
+        snprintf(table_name, sizeof(table_name), "server.table_%zu", i);
+        if (coml_image_get_value_int(&image, table_name, "key_4") != (int)(i*4)) return false;
+    }
+    report("coml_image_get_value_int", BENCH_TABLES, now()-start);
+
+    free(buffer);
+    coml_free(coml);
+
+    return true;
+}
+
+typedef enum {
+    Adversarial_Keys, // n keys in one table
+    Adversarial_Tables, // n table headers
+    Adversarial_List, // One list of n numbers
+    Adversarial_Escapes, // One string of n escape sequences
+    Adversarial_Depth, // One dotted key n segments deep
+    Adversarial_Count,
+} Adversarial_Kind;
+
+static const char* adversarial_names[Adversarial_Count] = { "many keys", "many tables", "long list", "escapes", "deep key" };
+
+static char* adversarial_input(Adversarial_Kind kind, size_t n, size_t* length) {
+    size_t capacity = n*32+64;
+    char* content = malloc(capacity);
+    if (content == NULL) return NULL;
+
+    size_t used = 0;
+    switch (kind) {
+        case Adversarial_Keys:
+            for (size_t i = 0; i < n; ++i) used += (size_t)snprintf(content+used, capacity-used, "k%zu = %zu\n", i, i);
+            break;
+        case Adversarial_Tables:
+            for (size_t i = 0; i < n; ++i) used += (size_t)snprintf(content+used, capacity-used, "[t%zu]\n", i);
+            break;
+        case Adversarial_List:
+            used += (size_t)snprintf(content+used, capacity-used, "list = [");
+            for (size_t i = 0; i < n; ++i) used += (size_t)snprintf(content+used, capacity-used, "%zu,", i);
+            used += (size_t)snprintf(content+used, capacity-used, "]\n");
+            break;
+        case Adversarial_Escapes:
+            used += (size_t)snprintf(content+used, capacity-used, "s = \"");
+            for (size_t i = 0; i < n; ++i) used += (size_t)snprintf(content+used, capacity-used, "\\u00e9");
+            used += (size_t)snprintf(content+used, capacity-used, "\"\n");
+            break;
+        case Adversarial_Depth:
+            for (size_t i = 0; i < n; ++i) used += (size_t)snprintf(content+used, capacity-used, "a.");
+            used += (size_t)snprintf(content+used, capacity-used, "b = 1\n");
+            break;
+        default:
+            break;
+    }
+
+    *length = used;
+    return content;
+}
+
+// Each shape at n and 4n, the same MB/s for both means parsing stays linear.
+// Then the shapes with limits set, parsing stops as soon as one is hit.
+static bool bench_adversarial(void) {
+    Coml_Limits limits = { 0 };
+    limits.max_input_bytes = 1 << 20;
+    limits.max_nodes = 10000;
+    limits.max_depth = 64;
+    limits.max_list_length = 1000;
+    limits.max_string_length = 1 << 12;
+    limits.max_memory = 1 << 22;
+
+    Coml_Options limited = { 0 };
+    limited.limits = &limits;
+
+    for (int kind = 0; kind < Adversarial_Count; ++kind) {
+        for (size_t scale = 1; scale <= 4; scale *= 4) {
+            size_t n = (kind == Adversarial_Depth ? 2000 : 50000)*scale;
+            size_t length = 0;
+            char* content = adversarial_input((Adversarial_Kind)kind, n, &length);
+            if (content == NULL) return false;
+
+            char name[40];
+            snprintf(name, sizeof(name), "%s x%zu", adversarial_names[kind], scale);
+            // Best of a few runs, a single one is too noisy to compare
+            double best = 0;
+            for (int run = 0; run < 3; ++run) {
+                double start = now();
+                Coml* coml = coml_parse_ex(content, length, NULL, NULL);
+                double seconds = now()-start;
+                if (coml == NULL) return false;
+                coml_free(coml);
+
+                if (run == 0 || seconds < best) best = seconds;
+            }
+            report_throughput(name, length, best);
+
+            Coml_Error error;
+            snprintf(name, sizeof(name), "%s x%zu limited", adversarial_names[kind], scale);
+            double start = now();
+            Coml* coml = coml_parse_ex(content, length, &limited, &error);
+            double seconds = now()-start;
+            printf("%-24s %8.2f MB %10.3f ms %s\n", name, (double)length/1e6, seconds*1e3, coml == NULL ? error.message : "accepted");
+            coml_free(coml);
+
+            free(content);
+        }
+    }
+
+    return true;
+}
+
+int main(void) {
+    if (!bench_build()) {
+        fprintf(stderr, "build benchmark failed\n");
+        return 1;
+    }
+
+    if (!bench_query()) {
+        fprintf(stderr, "query benchmark failed\n");
+        return 1;
+    }
+
+    if (!bench_image()) {
+        fprintf(stderr, "image benchmark failed\n");
+        return 1;
+    }
+
+    if (!bench_adversarial()) {
+        fprintf(stderr, "adversarial benchmark failed\n");
+        return 1;
+    }
+
+    if (!bench_json()) {
+        fprintf(stderr, "json benchmark failed\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -6,3 +6,6 @@ CC=clang
 CFLAGS="-Wall -Wextra -pedantic -ggdb -I."
 
 $CC $CFLAGS -o ./demo ./demo.c -lm
+$CC $CFLAGS -O2 -o ./bench ./bench.c -lm
+$CC $CFLAGS -o ./coml2json ./coml2json.c -lm
+$CC $CFLAGS -o ./test ./test.c -lm
@@ -11,12 +11,81 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 
 #ifndef COMLDEF
 #define COMLDEF static inline
 #endif
 
+// Compile-time allocator overrides, used by the default Coml_Allocator
+#ifndef COML_MALLOC
+#define COML_MALLOC(size) malloc(size)
+#endif
+#ifndef COML_REALLOC
+#define COML_REALLOC(ptr, size) realloc(ptr, size)
+#endif
+#ifndef COML_FREE
+#define COML_FREE(ptr) free(ptr)
+#endif
+
+// coml_image_map and coml_image_unmap need mmap, define COML_NO_MMAP to leave them out
+#if !defined(COML_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define COML_HAS_MMAP
+#endif
+
+// Runtime allocator, every allocation made by coml goes through it.
+// Sizes are reported on realloc and free so sized allocators can skip lookups.
+typedef struct {
+    void* (*alloc)(void* context, size_t size);
+    void* (*realloc)(void* context, void* ptr, size_t old_size, size_t new_size);
+    void (*free)(void* context, void* ptr, size_t size);
+    void* context;
+} Coml_Allocator;
+
+// Caps for untrusted input, 0 is no limit. Parsing stops at the first one that is hit with ComlError_LimitExceeded.
+typedef struct {
+    size_t max_input_bytes;
+    size_t max_nodes; // Keys and tables, a dotted key counts every table on its path
+    size_t max_depth; // Segments of a key or table name, nested objects in JSON
+    size_t max_list_length;
+    size_t max_string_length; // In bytes after escapes are decoded, keys included
+    size_t max_memory; // Bytes allocated while parsing, the document included
+} Coml_Limits;
+
+typedef struct {
+    const Coml_Allocator* allocator; // NULL uses COML_MALLOC/COML_REALLOC/COML_FREE
+    bool keep_source; // Keeps a copy of the input, coml_write_file then only rewrites what changed
+    const Coml_Limits* limits; // NULL for no limits
+} Coml_Options;
+
+typedef enum {
+    ComlError_None,
+    ComlError_OutOfMemory,
+    ComlError_EmptyInput,
+    ComlError_FileOpen,
+    ComlError_InvalidTable,
+    ComlError_InvalidKey,
+    ComlError_ExpectedEquals,
+    ComlError_InvalidValue,
+    ComlError_DuplicateKey,
+    ComlError_ExpectedNewLine,
+    ComlError_UnterminatedString,
+    ComlError_Unsupported, // Dates, inline tables, nested or mixed lists
+    ComlError_LimitExceeded, // One of the Coml_Limits, the message says which
+    ComlError_WriteFailed, // The output could not be written
+} Coml_Error_Code;
+
+// Filled in when parsing fails, line and column are computed from the offset only then
+typedef struct {
+    Coml_Error_Code code;
+    size_t offset; // Byte offset into the input
+    size_t line; // 1-based
+    size_t column; // 1-based, in bytes
+    const char* message;
+} Coml_Error;
+
 typedef enum {
     ComlType_Double,
     ComlType_String,
@@ -25,47 +94,132 @@ typedef enum {
     ComlType_ListString,
 } Coml_Type;
 
+// Byte range in the parsed input, end is 0 for nodes that weren't parsed
+typedef struct {
+    size_t start;
+    size_t end;
+} Coml_Span;
+
 typedef struct Coml_KV {
     const char* key;
     void* value;
     Coml_Type type;
     size_t list_length;
     struct Coml_KV* next;
+    struct Coml_KV* prev; // Lets a KV be unlinked in O(1)
+    Coml_Span line; // From the key to the end of the line
+    Coml_Span span; // The value
+    bool is_dirty; // Changed since parsing
 } Coml_KV;
 
+typedef struct {
+    const char* key; // Owned by the KV or the table it points to
+    void* node; // Coml_KV* or Coml_Table*, NULL for an empty slot
+    size_t hash;
+    bool is_table;
+} Coml_Index_Slot;
+
+// Open addressing hash map of the keys and child tables of one table
+typedef struct {
+    Coml_Index_Slot* slots;
+    size_t capacity; // Power of two, 0 until the first insert
+    size_t count;
+} Coml_Index;
+
 typedef struct Coml_Table {
-    const char* name;
+    const char* name; // Name relative to the parent table, "" for the root, NULL for array entries
     Coml_KV* items;
-    struct Coml_Table* next;
+    struct Coml_Table* tables; // Child tables
+    struct Coml_Table* next; // Next sibling
+    struct Coml_Table* prev; // Previous sibling
+    Coml_Index index;
+    bool is_defined; // Set by a [header], implicit parent tables can still be defined later
+    bool is_dotted; // Made by a dotted key, later dotted keys can add to it but a [header] can't define it
+    bool is_array; // Array of tables ([[name]]), the entries live in array
+    struct Coml_Table* array; // Contiguous, pointers to entries are invalidated when it grows
+    size_t array_length;
+    size_t array_capacity;
+    struct Coml_Table* shared; // Contents shared from another document by coml_clone or coml_merge, the fields above are then empty, coml_get_table returns the shared table and coml_edit_table a copy
+    bool is_own_shared; // shared holds this document's own tables, frozen by coml_clone or coml_merge, their spans are still in its source
+    Coml_Span header; // The [header] line
+    size_t source_end; // End of the table's last line in the input, new keys are written there
 } Coml_Table;
 
-typedef struct {
-    char* raw_content;
-    Coml_Table* tables;
-    Coml_KV* items;
-    size_t next_table;
+typedef struct Coml {
+    Coml_Table* root;
+    Coml_Allocator allocator;
+    size_t refs; // Documents sharing this one's tables hold a reference, freed when it drops to 0
+    struct Coml** sources; // Documents this one shares tables from
+    size_t sources_length;
+    size_t sources_capacity;
+    char* source; // Copy of the input with Coml_Options.keep_source, NULL otherwise
+    size_t source_length;
+    Coml_Span* removed; // Lines of removed KVs and tables
+    size_t removed_length;
+    size_t removed_capacity;
 } Coml;
 
+typedef enum {
+    ComlMerge_Overwrite, // Values from src replace the ones in dst
+    ComlMerge_Keep, // Values already in dst are kept
+    ComlMerge_Error, // A key in both with different values fails the merge
+} Coml_Merge_Policy;
+
+// Read-only view over documents, later layers take precedence
+typedef struct {
+    Coml** layers;
+    size_t layers_length;
+} Coml_Overlay;
+
+// Iterator over the tables and keys matching a pattern, see coml_query
+typedef struct {
+    const Coml_Table* table; // The matched table or array of tables entry, NULL if a key matched
+    const Coml_KV* kv; // The matched key, NULL if a table matched
+    Coml_Allocator allocator;
+    char* pattern; // Copy of the pattern, the segments point into it
+    struct Coml__Query_Segment* segments;
+    size_t segments_length;
+    struct Coml__Query_Frame* frames; // Tables being walked, the last one is the innermost
+    size_t frames_length;
+    size_t frames_capacity;
+} Coml_Query;
+
+COMLDEF Coml_Allocator coml_default_allocator(void);
+
 COMLDEF Coml* coml_from_file(const char* path); // Returns NULL if failed
-COMLDEF bool coml_write_file(Coml* coml, const char* path); // Returns false if failed
+COMLDEF Coml* coml_from_file_ex(const char* path, const Coml_Options* options, Coml_Error* error); // Returns NULL if failed, options and error can be NULL
+COMLDEF bool coml_write_file(Coml* coml, const char* path); // Returns false if failed, keeps comments and formatting if the source was kept
 COMLDEF void coml_format_kv(FILE* file, Coml_KV* kv);
 COMLDEF void coml_format_table(FILE* file, Coml_Table* table);
 
+COMLDEF Coml* coml_new(const Coml_Options* options); // Returns an empty document, NULL if out of memory, options can be NULL
 COMLDEF Coml* coml_parse(char* content, bool from_file); // Returns NULL if failed, set from_file to false
+COMLDEF Coml* coml_parse_ex(const char* content, size_t length, const Coml_Options* options, Coml_Error* error); // Returns NULL if failed, options and error can be NULL
 COMLDEF void coml_free(Coml* coml); // Frees the Coml structure
-
-COMLDEF void coml_free_split(char** split);
-
-COMLDEF bool coml_parse_kv(Coml_Table* table, char* input);
-COMLDEF bool coml_parse_table(Coml* coml);
-
-COMLDEF bool coml_parse_value(Coml_KV* kv, const char* value);
-COMLDEF Coml_KV* coml_new_kv(const char* key, const char* value);
-COMLDEF Coml_KV* coml_insert_kv(Coml_KV* kv, const char* key, const char* value);
-COMLDEF Coml_Table* coml_new_table(const char* name, Coml_KV* items);
-COMLDEF Coml_Table* coml_insert_table(Coml_Table* table, const char* name, Coml_KV* items);
-
-// Get values directly by table name and key
+COMLDEF Coml* coml_clone(Coml* coml); // Returns NULL if failed, both documents share all tables until they are changed
+COMLDEF bool coml_merge(Coml* dst, Coml* src, Coml_Merge_Policy policy); // Returns false on a conflict with ComlMerge_Error or if out of memory, dst can be partially merged then
+
+COMLDEF bool coml_parse_value(const Coml_Allocator* allocator, Coml_KV* kv, const char* value);
+COMLDEF Coml_KV* coml_new_kv(const Coml_Allocator* allocator, const char* key, const char* value); // Returns NULL if the value is invalid
+COMLDEF Coml_KV* coml_insert_kv(const Coml_Allocator* allocator, Coml_Table* table, const char* key, const char* value); // Returns NULL if failed or the key exists
+COMLDEF void coml_free_kv(const Coml_Allocator* allocator, Coml_KV* kv);
+COMLDEF Coml_Table* coml_new_table(const Coml_Allocator* allocator, const char* name);
+COMLDEF Coml_Table* coml_insert_table(const Coml_Allocator* allocator, Coml_Table* table, const char* name); // Returns the existing child table if there is one
+COMLDEF void coml_free_table(const Coml_Allocator* allocator, Coml_Table* table); // Frees the table with its items and child tables
+COMLDEF Coml_Table* coml_append_table_array(const Coml_Allocator* allocator, Coml_Table* table, const char* name); // Appends an entry to the array of tables, returns NULL if name is a plain table
+
+// Arrays of tables ([[name]]), entries are stored contiguously
+COMLDEF size_t coml_table_array_len(const Coml_Table* table); // Returns 0 if table isn't an array of tables
+COMLDEF const Coml_Table* coml_table_array_at(const Coml_Table* table, size_t index); // Returns NULL if out of range
+
+// Lookups by dotted path like "server.http.port", quoted keys are supported.
+// Tables can be shared with cloned or merged documents, so they are read-only, change them through coml_edit_*.
+COMLDEF const Coml_Table* coml_get_table(Coml* coml, const char* path); // NULL or "" is the root table
+COMLDEF const Coml_KV* coml_get_path(Coml* coml, const char* path);
+COMLDEF Coml_Table* coml_edit_table(Coml* coml, const char* path); // Table of this document only, for coml_insert_kv and the like, NULL for arrays of tables
+COMLDEF Coml_Table* coml_edit_table_array_at(Coml* coml, const char* path, size_t index); // Same for an entry of the array of tables at path
+
+// Get values directly by table name and key, table_name can be a dotted path, NULL or "" is the root table
 COMLDEF void* coml_get_value_raw(Coml* coml, Coml_Type type, const char* table_name, const char* key_name);
 COMLDEF int coml_get_value_int(Coml* coml, const char* table_name, const char* key_name);
 COMLDEF float coml_get_value_float(Coml* coml, const char* table_name, const char* key_name);
@@ -83,8 +237,16 @@ COMLDEF bool coml_find_value_bool(Coml* coml, const char* key_name);
 COMLDEF double* coml_find_value_list_double(Coml* coml, const char* key_name);
 COMLDEF char** coml_find_value_list_string(Coml* coml, const char* key_name);
 
-// Set the values, set table_name to NULL to search everywhere
-COMLDEF Coml_KV* coml_get_kv(Coml* coml, const char* table_name, const char* key_name);
+// Find every table and key matching a dotted pattern, in document order. A segment can be a name,
+// a glob like "*" or "web_*", or "**" for any number of tables. Entries of an array of tables
+// match the name of the array, once per entry, so "backend.timeout" reads the timeout of every [[backend]].
+COMLDEF bool coml_query(Coml* coml, const char* pattern, Coml_Query* query); // Returns false if the pattern is invalid or out of memory
+COMLDEF bool coml_query_next(Coml_Query* query); // Sets query->table or query->kv, returns false after the last match or if out of memory
+COMLDEF void coml_query_free(Coml_Query* query);
+
+// Set the values of existing keys. Unlike the getters and coml_add_*, a NULL table_name searches every table
+// for key_name and changes the first one found, "" is the root table
+COMLDEF Coml_KV* coml_get_kv(Coml* coml, const char* table_name, const char* key_name); // The KV belongs to this document only, so it can be changed
 COMLDEF bool coml_set_int(Coml* coml, int value, const char* table_name, const char* key_name);
 COMLDEF bool coml_set_float(Coml* coml, float value, const char* table_name, const char* key_name);
 COMLDEF bool coml_set_string(Coml* coml, char* value, const char* table_name, const char* key_name);
@@ -92,795 +254,5471 @@ COMLDEF bool coml_set_bool(Coml* coml, bool value, const char* table_name, const
 COMLDEF bool coml_set_list_double(Coml* coml, double* value, size_t length, const char* table_name, const char* key_name);
 COMLDEF bool coml_set_list_string(Coml* coml, char** value, size_t length, const char* table_name, const char* key_name);
 
+// Add values without going through text, missing tables on table_name are created, NULL or "" is the root table,
+// it doesn't search like coml_set_*. key_name is a single key, not a dotted path. An existing key is replaced whatever its type.
+COMLDEF bool coml_add_int(Coml* coml, int value, const char* table_name, const char* key_name);
+COMLDEF bool coml_add_float(Coml* coml, float value, const char* table_name, const char* key_name);
+COMLDEF bool coml_add_string(Coml* coml, const char* value, const char* table_name, const char* key_name);
+COMLDEF bool coml_add_bool(Coml* coml, bool value, const char* table_name, const char* key_name);
+COMLDEF bool coml_add_list_double(Coml* coml, const double* value, size_t length, const char* table_name, const char* key_name);
+COMLDEF bool coml_add_list_string(Coml* coml, char** value, size_t length, const char* table_name, const char* key_name);
+COMLDEF bool coml_remove_key(Coml* coml, const char* table_name, const char* key_name); // NULL or "" is the root table, returns false if there is no such key
+COMLDEF Coml_Table* coml_add_table(Coml* coml, const char* path); // Returns the existing table if there is one, NULL if path names a key or an array of tables
+COMLDEF bool coml_remove_table(Coml* coml, const char* path); // Removes the table with everything in it, arrays of tables too
+
 COMLDEF void coml_print_kv(const Coml_KV* kv, bool indent);
 COMLDEF void coml_print_table(const Coml_Table* table);
 COMLDEF void coml_print(const Coml* coml); // Prints the Coml structure
 
-COMLDEF char* coml_trim(char* input);
-COMLDEF char** coml_split(char* input, char* delim);
-COMLDEF size_t coml_split_length(char** split);
+// TOML is converted to JSON line by line without building a Coml, so each table has to be in one place
+COMLDEF bool coml_toml_to_json(const char* content, size_t length, FILE* file, const Coml_Options* options, Coml_Error* error); // Returns false if failed, the output stops where it failed then
+COMLDEF bool coml_write_json(Coml* coml, FILE* file); // Returns false if out of memory or writing failed
+COMLDEF Coml* coml_from_json(const char* content, size_t length, const Coml_Options* options, Coml_Error* error); // Returns NULL if failed, arrays of objects become arrays of tables
+
+// Get values from the last layer that has the key, without merging the layers, table_name works like in coml_get_value_*
+COMLDEF const Coml_KV* coml_overlay_get_kv(const Coml_Overlay* overlay, const char* table_name, const char* key_name); // A NULL table_name searches every table like coml_get_kv, returns NULL if no layer has the key
+COMLDEF void* coml_overlay_get_value_raw(const Coml_Overlay* overlay, Coml_Type type, const char* table_name, const char* key_name);
+COMLDEF int coml_overlay_get_int(const Coml_Overlay* overlay, const char* table_name, const char* key_name);
+COMLDEF float coml_overlay_get_float(const Coml_Overlay* overlay, const char* table_name, const char* key_name);
+COMLDEF char* coml_overlay_get_string(const Coml_Overlay* overlay, const char* table_name, const char* key_name);
+COMLDEF bool coml_overlay_get_bool(const Coml_Overlay* overlay, const char* table_name, const char* key_name);
+COMLDEF double* coml_overlay_get_list_double(const Coml_Overlay* overlay, const char* table_name, const char* key_name);
+COMLDEF char** coml_overlay_get_list_string(const Coml_Overlay* overlay, const char* table_name, const char* key_name);
+
+// Schema binding, fills a struct from the document in one pass.
+// Fields are listed with an X-macro of X(Type, field, "table", "key", KIND, required, default)
+// entries, KIND is INT, FLOAT, DOUBLE, BOOL or STRING, see the README for an example.
+// Strings point into the document, or at the default, and live as long as the Coml.
+typedef enum {
+    ComlBind_Int,
+    ComlBind_Float,
+    ComlBind_Double,
+    ComlBind_Bool,
+    ComlBind_String,
+} Coml_Bind_Kind;
+
+typedef struct {
+    const char* table; // Dotted path, "" for the root
+    const char* key;
+    Coml_Bind_Kind kind;
+    size_t offset;
+    bool is_required;
+    double default_number;
+    bool default_bool;
+    const char* default_string;
+    size_t hash; // Set by coml_schema_prepare
+} Coml_Field;
+
+typedef struct {
+    Coml_Field* fields;
+    size_t fields_length;
+    size_t* slots; // Perfect hash, field index+1 or 0, fields_length*2 entries
+    size_t* displacements; // One per bucket, fields_length entries
+    bool is_prepared;
+    bool is_perfect; // False if no perfect hash was found, fields are then matched linearly
+} Coml_Schema;
+
+typedef enum {
+    ComlBindIssue_Missing, // Required field isn't in the document
+    ComlBindIssue_Mistyped, // Field has a different type, the default was used
+} Coml_Bind_Issue_Kind;
+
+typedef struct {
+    const Coml_Field* field;
+    Coml_Bind_Issue_Kind kind;
+} Coml_Bind_Issue;
+
+#define COML__FIELD_CHECK(type, field, ctype) (0*sizeof(char[sizeof(((type*)0)->field) == sizeof(ctype) ? 1 : -1]))
+#define COML__FIELD_INT(type, field, table, key, required, default_value) \
+    { table, key, ComlBind_Int, offsetof(type, field)+COML__FIELD_CHECK(type, field, int), required, (double)(default_value), false, NULL, 0 }
+#define COML__FIELD_FLOAT(type, field, table, key, required, default_value) \
+    { table, key, ComlBind_Float, offsetof(type, field)+COML__FIELD_CHECK(type, field, float), required, (double)(default_value), false, NULL, 0 }
+#define COML__FIELD_DOUBLE(type, field, table, key, required, default_value) \
+    { table, key, ComlBind_Double, offsetof(type, field)+COML__FIELD_CHECK(type, field, double), required, (double)(default_value), false, NULL, 0 }
+#define COML__FIELD_BOOL(type, field, table, key, required, default_value) \
+    { table, key, ComlBind_Bool, offsetof(type, field)+COML__FIELD_CHECK(type, field, bool), required, 0, (default_value), NULL, 0 }
+#define COML__FIELD_STRING(type, field, table, key, required, default_value) \
+    { table, key, ComlBind_String, offsetof(type, field)+COML__FIELD_CHECK(type, field, const char*), required, 0, false, (default_value), 0 }
+#define COML_SCHEMA_FIELD(type, field, table, key, kind, required, default_value) \
+    COML__FIELD_##kind(type, field, table, key, required, default_value),
+
+#define COML_SCHEMA(name, FIELDS) \
+    static Coml_Field name##_fields[] = { FIELDS(COML_SCHEMA_FIELD) }; \
+    static size_t name##_slots[2*sizeof(name##_fields)/sizeof(Coml_Field)]; \
+    static size_t name##_displacements[sizeof(name##_fields)/sizeof(Coml_Field)]; \
+    static Coml_Schema name = { name##_fields, sizeof(name##_fields)/sizeof(Coml_Field), name##_slots, name##_displacements, false, false }
+
+COMLDEF void coml_schema_prepare(Coml_Schema* schema); // Done by the first coml_bind, call it first when binding from several threads
+// Returns the number of missing or mistyped fields, which can be more than max_issues, only the first max_issues are stored in issues.
+// A NULL coml binds every default and reports every required field as missing. Schemas of more than 64 fields
+// allocate while binding, (size_t)-1 is returned if that fails, out is then left as it was.
+COMLDEF size_t coml_bind(Coml* coml, Coml_Schema* schema, void* out, Coml_Bind_Issue* issues, size_t max_issues);
+
+// Read-only copy of a document in one block using offsets instead of pointers,
+// so it can be placed in shared memory or a file and used by other processes
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    size_t mapped_size; // Set by coml_image_map, 0 otherwise
+    size_t root; // Table the getters start from, the root unless set by coml_image_table_array_at
+} Coml_Image;
+
+COMLDEF size_t coml_image_size(Coml* coml); // Returns 0 if the document is too big for an image (4 GB)
+COMLDEF bool coml_image_write(Coml* coml, void* buffer, size_t size); // buffer has to be 8 byte aligned and at least coml_image_size big
+COMLDEF bool coml_write_image_file(Coml* coml, const char* path); // Returns false if failed
+COMLDEF bool coml_image_open(Coml_Image* image, const void* data, size_t size); // Returns false if data isn't an image, data has to stay valid
+#ifdef COML_HAS_MMAP
+COMLDEF bool coml_image_map(Coml_Image* image, const char* path); // Maps an image file read-only, pages are shared with other processes
+COMLDEF void coml_image_unmap(Coml_Image* image);
+#endif
+
+// Same as the coml_get_value_* functions, values point into the image
+COMLDEF const void* coml_image_get_value_raw(const Coml_Image* image, Coml_Type type, const char* table_name, const char* key_name);
+COMLDEF int coml_image_get_value_int(const Coml_Image* image, const char* table_name, const char* key_name);
+COMLDEF float coml_image_get_value_float(const Coml_Image* image, const char* table_name, const char* key_name);
+COMLDEF const char* coml_image_get_value_string(const Coml_Image* image, const char* table_name, const char* key_name);
+COMLDEF bool coml_image_get_value_bool(const Coml_Image* image, const char* table_name, const char* key_name);
+COMLDEF const double* coml_image_get_value_list_double(const Coml_Image* image, const char* table_name, const char* key_name);
+COMLDEF size_t coml_image_get_list_length(const Coml_Image* image, const char* table_name, const char* key_name); // 0 if the key isn't a list
+COMLDEF const char* coml_image_get_list_string_at(const Coml_Image* image, const char* table_name, const char* key_name, size_t index); // Lists of strings are offsets in the image, so they are read one at a time
+
+// Same as the coml_find_value_* functions, searches every table below the one the image starts from
+COMLDEF const void* coml_image_find_value_raw(const Coml_Image* image, Coml_Type type, const char* key_name);
+COMLDEF int coml_image_find_value_int(const Coml_Image* image, const char* key_name);
+COMLDEF float coml_image_find_value_float(const Coml_Image* image, const char* key_name);
+COMLDEF const char* coml_image_find_value_string(const Coml_Image* image, const char* key_name);
+COMLDEF bool coml_image_find_value_bool(const Coml_Image* image, const char* key_name);
+COMLDEF const double* coml_image_find_value_list_double(const Coml_Image* image, const char* key_name);
+COMLDEF size_t coml_image_find_list_length(const Coml_Image* image, const char* key_name);
+COMLDEF const char* coml_image_find_list_string_at(const Coml_Image* image, const char* key_name, size_t index);
+
+// Arrays of tables, an entry is read through an image that starts from it
+COMLDEF size_t coml_image_table_array_len(const Coml_Image* image, const char* path); // Returns 0 if path isn't an array of tables
+COMLDEF bool coml_image_table_array_at(const Coml_Image* image, const char* path, size_t index, Coml_Image* entry); // Returns false if out of range, entry isn't mapped and needs no coml_image_unmap
 
 #endif // COML_H_
 
 #ifdef COML_IMPLEMENTATION
 
-COMLDEF Coml* coml_from_file(const char* path) {
-    FILE* file = fopen(path, "r");
-    if (file == NULL) return NULL;
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    rewind(file);
+#ifdef COML_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-    char* content = (char*)malloc(file_size+1);
-    if (content == NULL) return NULL;
+static void* coml__default_alloc(void* context, size_t size) {
+    (void)context;
+    return COML_MALLOC(size);
+}
 
-    fread(content, 1, file_size, file); 
+static void* coml__default_realloc(void* context, void* ptr, size_t old_size, size_t new_size) {
+    (void)context;
+    (void)old_size;
+    return COML_REALLOC(ptr, new_size);
+}
 
-    Coml* coml = coml_parse(strdup(content), true);
-    if (coml == NULL) {
-        free(content);
-        return NULL;
-    }
+static void coml__default_free(void* context, void* ptr, size_t size) {
+    (void)context;
+    (void)size;
+    COML_FREE(ptr);
+}
 
-    free(content);
-    fclose(file);
+COMLDEF Coml_Allocator coml_default_allocator(void) {
+    Coml_Allocator allocator = {
+        coml__default_alloc,
+        coml__default_realloc,
+        coml__default_free,
+        NULL,
+    };
 
-    return coml;
+    return allocator;
 }
 
-COMLDEF bool coml_write_file(Coml* coml, const char* path) {
-    if (coml == NULL || path == NULL || strcmp(path, "") == 0) return false;
+static void* coml__alloc(const Coml_Allocator* allocator, size_t size) {
+    return allocator->alloc(allocator->context, size);
+}
 
-    FILE* file = fopen(path, "w");
-    if (file == NULL) return false;
+static void* coml__realloc(const Coml_Allocator* allocator, void* ptr, size_t old_size, size_t new_size) {
+    if (ptr == NULL) return allocator->alloc(allocator->context, new_size);
+    return allocator->realloc(allocator->context, ptr, old_size, new_size);
+}
 
-    Coml_KV* alone_kv = coml->items;
-    coml_format_kv(file, alone_kv);
+static void coml__free(const Coml_Allocator* allocator, void* ptr, size_t size) {
+    if (ptr == NULL) return;
+    allocator->free(allocator->context, ptr, size);
+}
 
-    fprintf(file, "\n");
+static char* coml__strndup(const Coml_Allocator* allocator, const char* input, size_t length) {
+    char* out = (char*)coml__alloc(allocator, length+1);
+    if (out == NULL) return NULL;
 
-    Coml_Table* current_table = coml->tables;
-    coml_format_table(file, current_table);
+    memcpy(out, input, length);
+    out[length] = '\0';
 
-    fclose(file);
+    return out;
+}
 
-    return true;
+static char* coml__strdup(const Coml_Allocator* allocator, const char* input) {
+    return coml__strndup(allocator, input, strlen(input));
 }
 
-COMLDEF void coml_format_kv(FILE* file, Coml_KV* kv) {
-    if (kv == NULL) return;
+static void coml__free_string(const Coml_Allocator* allocator, const char* input) {
+    if (input == NULL) return;
+    coml__free(allocator, (void*)input, strlen(input)+1);
+}
 
-    coml_format_kv(file, kv->next);
+static void coml__free_value(const Coml_Allocator* allocator, Coml_Type type, void* value, size_t list_length) {
+    if (value == NULL) return;
 
-    switch (kv->type) {
+    switch (type) {
         case ComlType_Double:
-            if (floor(*(double*)kv->value) == *(double*)kv->value) {
-                fprintf(file, "%s = %i\n", kv->key, (int)*(double*)kv->value); 
-            } else {
-                fprintf(file, "%s = %.5f\n", kv->key, *(double*)kv->value); 
-            }
+            coml__free(allocator, value, sizeof(double));
             break;
         case ComlType_String:
-            fprintf(file, "%s = \"%s\"\n", kv->key, (char*)kv->value);
+            coml__free_string(allocator, (char*)value);
             break;
         case ComlType_Boolean:
-            fprintf(file, "%s = %s\n", kv->key, *(bool*)kv->value ? "true" : "false");
+            coml__free(allocator, value, sizeof(bool));
             break;
-        case ComlType_ListDouble: {
-            char* line = (char*)malloc(sizeof(char*)+1);
-            sprintf(line, "%s = [", kv->key);
-            for (size_t i = 0; i < kv->list_length; ++i) {
-                if (floor(((double*)kv->value)[i]) == ((double*)kv->value)[i]) {
-                    sprintf(line, "%s %i%s", line, (int)((double*)kv->value)[i], i == kv->list_length-1 ? "" : ","); 
-                } else {
-                    sprintf(line, "%s %.5f%s", line, ((double*)kv->value)[i], i == kv->list_length-1 ? "" : ","); 
-                }
-            }
-            sprintf(line, "%s ]", line); 
-            fprintf(file, "%s\n", line);
-            free(line);
+        case ComlType_ListDouble:
+            coml__free(allocator, value, sizeof(double)*list_length);
             break;
-        }
-        case ComlType_ListString: {
-            char* line = (char*)malloc(sizeof(char*)+1);
-            sprintf(line, "%s = [", kv->key);
-            for (size_t i = 0; i < kv->list_length; ++i) {
-                sprintf(line, "%s \"%s\"%s", line, ((char**)kv->value)[i], i == kv->list_length-1 ? "" : ","); 
+        case ComlType_ListString:
+            for (size_t i = 0; i < list_length; ++i) {
+                coml__free_string(allocator, ((char**)value)[i]);
             }
-            sprintf(line, "%s ]", line); 
-            fprintf(file, "%s\n", line);
-            free(line);
-            break;
-        }
-        default:
-            fprintf(file, "%s = \"NULL (default)\"\n", kv->key); 
+            coml__free(allocator, value, sizeof(char*)*list_length);
             break;
     }
 }
 
-COMLDEF void coml_format_table(FILE* file, Coml_Table* table) {
-    if (table == NULL) return;
+#define COML__HASH_BASIS ((size_t)14695981039346656037ULL)
 
-    coml_format_table(file, table->next);
+static size_t coml__hash_continue(size_t hash, const char* key, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char)key[i];
+        hash *= (size_t)1099511628211ULL;
+    }
 
-    fprintf(file, "[%s]\n", table->name); 
+    return hash;
+}
 
-    Coml_KV* current_kv = table->items;
-    coml_format_kv(file, current_kv);
+static size_t coml__hash(const char* key, size_t length) {
+    return coml__hash_continue(COML__HASH_BASIS, key, length);
+}
 
-    fprintf(file, "\n"); 
+// Table holding the contents of table, follows shared tables
+static Coml_Table* coml__body(const Coml_Table* table) {
+    while (table->shared != NULL) table = table->shared;
+    return (Coml_Table*)table;
 }
 
-COMLDEF Coml* coml_parse(char* content, bool from_file) {
-    Coml* coml = (Coml*)malloc(sizeof(Coml));
-    
-    if (content == NULL || strcmp(content, "") == 0) {
-        if (from_file) free(content);
-        free(coml);
-        return NULL;
-    }
-    
-    coml->raw_content = strdup(content);
-    coml->tables = NULL;
-    coml->items = NULL;
-    coml->next_table = 0;
-    
-    char** lines = coml_split(coml->raw_content, "\n");
-    
-    for (size_t i = 0; lines[i][0] != '['; ++i) {
-        if (lines[i][0] == '#') continue;
+static bool coml__materialize(const Coml_Allocator* allocator, Coml_Table* table);
 
-        char* trim = coml_trim(lines[i]);
-        char** parts = coml_split(trim, "=");
-        if (parts == NULL) {
-            free(trim);
-            break;
-        }
+// Lists are kept newest first, the printers walk them backwards to get document order
+static void coml__push_kv(Coml_Table* table, Coml_KV* kv) {
+    kv->prev = NULL;
+    kv->next = table->items;
+    if (table->items != NULL) table->items->prev = kv;
+    table->items = kv;
+}
+
+static void coml__push_table(Coml_Table* table, Coml_Table* child) {
+    child->prev = NULL;
+    child->next = table->tables;
+    if (table->tables != NULL) table->tables->prev = child;
+    table->tables = child;
+}
 
-        coml->items = coml_insert_kv(coml->items, parts[0], parts[1]);
+static bool coml__key_equals(const char* key, const char* other, size_t length) {
+    return strncmp(key, other, length) == 0 && key[length] == '\0';
+}
 
-        free(trim);
-        coml_free_split(parts);
+static Coml_Index_Slot* coml__index_find(const Coml_Index* index, const char* key, size_t length, size_t hash) {
+    if (index->capacity == 0) return NULL;
 
-        coml->next_table = i+1;
+    size_t mask = index->capacity-1;
+    for (size_t i = hash & mask;; i = (i+1) & mask) {
+        Coml_Index_Slot* slot = &index->slots[i];
+        if (slot->node == NULL) return NULL;
+        if (slot->hash == hash && coml__key_equals(slot->key, key, length)) return slot;
     }
+}
 
-    size_t length = coml_split_length(lines);
-    coml_free_split(lines);
+static void coml__index_place(Coml_Index* index, Coml_Index_Slot slot) {
+    size_t mask = index->capacity-1;
+    size_t i = slot.hash & mask;
+    while (index->slots[i].node != NULL) i = (i+1) & mask;
 
-    while (coml->next_table != length) {
-        bool res = coml_parse_table(coml);
-        if (!res) {
-            if (from_file) free(content);
-            coml_free(coml);
-            return NULL;
+    index->slots[i] = slot;
+}
+
+// The key must not be in the index yet
+static bool coml__index_insert(const Coml_Allocator* allocator, Coml_Index* index, const char* key, void* node, bool is_table) {
+    if ((index->count+1)*4 > index->capacity*3) {
+        size_t new_capacity = index->capacity == 0 ? 8 : index->capacity*2;
+        Coml_Index_Slot* new_slots = (Coml_Index_Slot*)coml__alloc(allocator, sizeof(Coml_Index_Slot)*new_capacity);
+        if (new_slots == NULL) return false;
+        memset(new_slots, 0, sizeof(Coml_Index_Slot)*new_capacity);
+
+        Coml_Index old = *index;
+        index->slots = new_slots;
+        index->capacity = new_capacity;
+        for (size_t i = 0; i < old.capacity; ++i) {
+            if (old.slots[i].node != NULL) coml__index_place(index, old.slots[i]);
         }
+
+        coml__free(allocator, old.slots, sizeof(Coml_Index_Slot)*old.capacity);
     }
 
-    if (from_file) free(content);
-    
-    return coml;
-}
+    Coml_Index_Slot slot = { key, node, coml__hash(key, strlen(key)), is_table };
+    coml__index_place(index, slot);
+    index->count += 1;
 
-COMLDEF void coml_free(Coml* coml) {
-    if (coml == NULL) return;
-    
-    Coml_Table* current_table = coml->tables;
-    while (current_table != NULL) {
-        Coml_Table* temp_table = current_table;
-        current_table = current_table->next;
-        
-        Coml_KV* current_kv = temp_table->items;
-        while (current_kv != NULL) {
-            Coml_KV* temp_kv = current_kv;
-            current_kv = current_kv->next;
-            free((void*)temp_kv->key);
-            if (temp_kv->type == ComlType_ListString) {
-                for (size_t i = 0; i < temp_kv->list_length; ++i) {
-                    free(((char**)temp_kv->value)[i]);
-                }
+    return true;
+}
 
-                free(temp_kv->value);
-            } else {
-                free(temp_kv->value);
-            }
-            free(temp_kv);
-        }
-        
-        free((void*)temp_table->name);
-        free(temp_table);
+// Backward shift deletion, keeps every probe sequence unbroken without tombstones
+static void coml__index_remove(Coml_Index* index, Coml_Index_Slot* slot) {
+    size_t mask = index->capacity-1;
+    size_t i = (size_t)(slot-index->slots);
+    for (size_t j = (i+1) & mask; index->slots[j].node != NULL; j = (j+1) & mask) {
+        size_t home = index->slots[j].hash & mask;
+        bool is_between = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (is_between) continue;
+
+        index->slots[i] = index->slots[j];
+        i = j;
     }
 
-    Coml_KV* alone_kv = coml->items;
-    while (alone_kv != NULL) {
-        Coml_KV* temp_kv = alone_kv;
-        alone_kv = alone_kv->next;
-        free((void*)temp_kv->key);
-        if (temp_kv->type == ComlType_ListString) {
-            for (size_t i = 0; i < temp_kv->list_length; ++i) {
-                free(((char**)temp_kv->value)[i]);
-            }
+    memset(&index->slots[i], 0, sizeof(Coml_Index_Slot));
+    index->count -= 1;
+}
 
-            free(temp_kv->value);
-        } else {
-            free(temp_kv->value);
-        }
+static void coml__index_free(const Coml_Allocator* allocator, Coml_Index* index) {
+    coml__free(allocator, index->slots, sizeof(Coml_Index_Slot)*index->capacity);
+    index->slots = NULL;
+    index->capacity = 0;
+    index->count = 0;
+}
 
-        free(temp_kv);
-    }
-    
-    free(coml->raw_content);
-    free(coml);
+static bool coml__is_bare_key_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-';
 }
 
-COMLDEF void coml_free_split(char** split) {
-    for (size_t i = 0; split[i] != NULL; ++i) {
-        free(split[i]);
-    }
-    
-    free(split);
+static bool coml__is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
 }
 
-COMLDEF bool coml_parse_kv(Coml_Table* table, char* input) {
-    if (table == NULL) return false;
-    
-    char* trim = coml_trim(input);
-    char** parts = coml_split(trim, "=");
-    if (parts == NULL) {
-        free(trim);
-        return false;
+// Reads one segment of a dotted key and the dot after it, pos is left at end after the last segment
+static bool coml__next_key_segment(const char* input, size_t* pos, size_t end, size_t* segment_start, size_t* segment_length) {
+    size_t i = *pos;
+    while (i < end && coml__is_space(input[i])) ++i;
+    if (i == end) return false;
+
+    if (input[i] == '"' || input[i] == '\'') {
+        const char* close = (const char*)memchr(input+i+1, input[i], end-i-1);
+        if (close == NULL) return false;
+
+        *segment_start = i+1;
+        *segment_length = (size_t)(close-input)-i-1;
+        i = (size_t)(close-input)+1;
+    } else {
+        *segment_start = i;
+        while (i < end && coml__is_bare_key_char(input[i])) ++i;
+        *segment_length = i-*segment_start;
+        if (*segment_length == 0) return false;
     }
-    
-    table->items = coml_insert_kv(table->items, parts[0], parts[1]);
-    
-    free(trim);
-    coml_free_split(parts);
-    
+
+    while (i < end && coml__is_space(input[i])) ++i;
+    if (i < end) {
+        if (input[i] != '.') return false;
+        ++i;
+        while (i < end && coml__is_space(input[i])) ++i;
+        if (i == end) return false;
+    }
+
+    *pos = i;
     return true;
 }
 
-COMLDEF bool coml_parse_table(Coml* coml) {
-    if (coml == NULL) return false;
-    
-    char** lines = coml_split(coml->raw_content, "\n");
-    if (lines == NULL) return false;
-    if (lines[coml->next_table][0] == '#') coml->next_table += 1;
-    
-    char* table_name = (char*)malloc(strlen(lines[coml->next_table])-1);
-    memset(table_name, 0, strlen(lines[coml->next_table])-1);
-    if (table_name == NULL) {
-        coml_free_split(lines);
-        return false;
+// A limit of 0 is no limit
+static bool coml__exceeds(size_t limit, size_t value) {
+    return limit != 0 && value > limit;
+}
+
+static bool coml__set_error(Coml_Error* error, Coml_Error_Code code, size_t offset, const char* message) {
+    if (error != NULL) {
+        error->code = code;
+        error->offset = offset;
+        error->line = 0;
+        error->column = 0;
+        error->message = message;
     }
-    
-    strncpy(table_name, lines[coml->next_table]+1, strlen(lines[coml->next_table])-2);
-    
-    Coml_Table* new_table = coml_new_table(table_name, NULL);
 
-    for (size_t i = coml->next_table+1; lines[i] != NULL; ++i) {
-        if (lines[i][0] == '#') continue;
+    return false;
+}
 
-        if (lines[i][0] == '[') {
-            coml->next_table = i;
-            break;
-        }
-        
-        if (lines[i+1] == NULL) coml->next_table = i+1;
-        
-        bool res = coml_parse_kv(new_table, lines[i]);
-        if (!res) {
-            coml_free_split(lines);
-            free(table_name);
-            free((void*)new_table->name);
-            free(new_table);
-            return false;
+// Only called once parsing failed, so the happy path never tracks lines
+static void coml__locate_error(Coml_Error* error, const char* content, size_t length) {
+    if (error == NULL || error->code == ComlError_None) return;
+
+    size_t offset = error->offset < length ? error->offset : length;
+    size_t line_start = 0;
+
+    error->line = 1;
+    for (size_t i = 0; i < offset; ++i) {
+        if (content[i] == '\n') {
+            error->line += 1;
+            line_start = i+1;
         }
     }
-    
-    coml->tables = coml_insert_table(coml->tables, new_table->name, new_table->items);
-    
-    coml_free_split(lines);
-    free(table_name);
-    free((void*)new_table->name);
-    free(new_table);
-    
-    return true;
+
+    error->column = offset-line_start+1;
 }
 
-COMLDEF bool coml_parse_value(Coml_KV* kv, const char *input) {
-    if (input[0] == '"' || input[0] == '\'') {
-        if (input[0] == '"' && input[strlen(input)-1] != '"') return false;
-        if (input[0] == '\'' && input[strlen(input)-1] != '\'') return false;
+COMLDEF Coml* coml_from_file(const char* path) {
+    return coml_from_file_ex(path, NULL, NULL);
+}
 
-        char* actual_string = (char*)malloc(strlen(input)-1);
-        strncpy(actual_string, input+1, strlen(input)-2);
+COMLDEF Coml* coml_from_file_ex(const char* path, const Coml_Options* options, Coml_Error* error) {
+    Coml_Allocator allocator = options != NULL && options->allocator != NULL ? *options->allocator : coml_default_allocator();
 
-        kv->value = strdup(actual_string);
-        kv->type = ComlType_String;
-        kv->list_length = 0;
-        
-        free(actual_string);
-        return true;
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        coml__set_error(error, ComlError_FileOpen, 0, "could not open file");
+        return NULL;
     }
+    fseek(file, 0, SEEK_END);
+    long file_size = ftell(file);
+    rewind(file);
 
-    if (input[0] == '[') {
-        if (input[strlen(input)-1] != ']') return false;
+    if (file_size < 0) {
+        fclose(file);
+        coml__set_error(error, ComlError_FileOpen, 0, "could not read file");
+        return NULL;
+    }
 
-        char* actual_list = (char*)malloc(strlen(input)-1);
-        strncpy(actual_list, input+1, strlen(input)-2);
+    // Checked before reading, a huge file isn't loaded just to be rejected
+    if (options != NULL && options->limits != NULL && coml__exceeds(options->limits->max_input_bytes, (size_t)file_size)) {
+        fclose(file);
+        coml__set_error(error, ComlError_LimitExceeded, 0, "input is too large");
+        return NULL;
+    }
 
-        char** list_elements = coml_split(actual_list, ",");
-        size_t list_length = coml_split_length(list_elements);
+    char* content = (char*)coml__alloc(&allocator, file_size+1);
+    if (content == NULL) {
+        fclose(file);
+        coml__set_error(error, ComlError_OutOfMemory, 0, "out of memory");
+        return NULL;
+    }
 
-        if (list_elements[0][0] == '"' || list_elements[0][0] == '\'') {
-            if (list_elements[0][0] == '"' && list_elements[0][strlen(list_elements[0])-1] != '"') {
-                free(actual_list);
-                coml_free_split(list_elements);
-                return false;
-            }
-            if (list_elements[0][0] == '\'' && list_elements[0][strlen(list_elements[0])-1] != '\'') {
-                free(actual_list);
-                coml_free_split(list_elements);
-                return false;
-            }
+    size_t read_size = fread(content, 1, file_size, file);
+    content[read_size] = '\0';
+    fclose(file);
 
-            kv->value = malloc(sizeof(char*)*list_length+list_length);
+    Coml* coml = coml_parse_ex(content, read_size, options, error);
 
-            for (size_t i = 0; list_elements[i] != NULL; ++i) {
-                char* string_value = (char*)malloc(strlen(list_elements[i])-1);
-                strncpy(string_value, list_elements[i]+1, strlen(list_elements[i])-2);
-                string_value[strlen(list_elements[i])-2] = '\0';
-                
-                ((char**)kv->value)[i] = strdup(string_value);
+    coml__free(&allocator, content, file_size+1);
 
-                free(string_value);
-            }
+    return coml;
+}
 
-            kv->type = ComlType_ListString;
-        } else {
-            kv->value = malloc(sizeof(double)*list_length);
+static bool coml__write_spliced(Coml* coml, FILE* file);
 
-            for (size_t i = 0; list_elements[i] != NULL; ++i) {
-                double val = atof(list_elements[i]);
-                ((double*)kv->value)[i] = val;
-            }
+COMLDEF bool coml_write_file(Coml* coml, const char* path) {
+    if (coml == NULL || path == NULL || strcmp(path, "") == 0) return false;
 
-            kv->type = ComlType_ListDouble;
-        }
-        
-        kv->list_length = list_length;
+    FILE* file = fopen(path, coml->source != NULL ? "wb" : "w");
+    if (file == NULL) return false;
 
-        free(actual_list);
-        coml_free_split(list_elements);
-        return true;
+    if (coml->source != NULL) {
+        bool res = coml__write_spliced(coml, file);
+        fclose(file);
+        return res;
     }
 
-    if (strcmp(input, "true") == 0 || strcmp(input, "false") == 0) {
-        kv->value = malloc(sizeof(bool));
-        *((bool*)kv->value) = strcmp(input, "true") == 0;
-        kv->type = ComlType_Boolean;
-        kv->list_length = 0;
+    Coml_Table* root = coml__body(coml->root);
+    coml_format_kv(file, root->items);
 
-        return true;
-    }
+    fprintf(file, "\n");
+
+    coml_format_table(file, root->tables);
+
+    fclose(file);
 
-    kv->value = malloc(sizeof(double));
-    double val = atof(input);
-    *((double*)kv->value) = val;
-    kv->type = ComlType_Double;
-    kv->list_length = 0;
-    
     return true;
 }
 
-COMLDEF Coml_KV* coml_new_kv(const char* key, const char* value) {
-    Coml_KV* kv = (Coml_KV*)malloc(sizeof(Coml_KV));
-    if (kv != NULL) {
-        kv->key = strdup(key);
-        bool res = coml_parse_value(kv, value);
-        if (!res) kv->value = NULL;
-        kv->next = NULL;
+// Parent chain of the table being formatted, lives on the stack
+typedef struct Coml__Path {
+    const char* name;
+    const struct Coml__Path* parent;
+    bool is_array_entry;
+    size_t array_index;
+} Coml__Path;
+
+static void coml__format_string(FILE* file, const char* string) {
+    fputc('"', file);
+
+    for (const char* iter = string; *iter != '\0'; ++iter) {
+        unsigned char c = (unsigned char)*iter;
+        switch (c) {
+            case '"': fputs("\\\"", file); break;
+            case '\\': fputs("\\\\", file); break;
+            case '\n': fputs("\\n", file); break;
+            case '\t': fputs("\\t", file); break;
+            case '\r': fputs("\\r", file); break;
+            case '\b': fputs("\\b", file); break;
+            case '\f': fputs("\\f", file); break;
+            default:
+                if (c < 0x20 || c == 0x7F) {
+                    fprintf(file, "\\u%04X", c);
+                } else {
+                    fputc(c, file);
+                }
+                break;
+        }
     }
-    
-    return kv;
+
+    fputc('"', file);
 }
 
-COMLDEF Coml_KV* coml_insert_kv(Coml_KV* kv, const char* key, const char* value) {
-    Coml_KV* new_kv = coml_new_kv(key, value);
-    if (new_kv != NULL) {
-        new_kv->next = kv;
-        kv = new_kv;
+static void coml__format_number(FILE* file, double value) {
+    if (isnan(value)) {
+        fprintf(file, "nan");
+    } else if (isinf(value)) {
+        fprintf(file, "%s", value < 0 ? "-inf" : "inf");
+    } else if (floor(value) == value) {
+        fprintf(file, "%.0f", value);
+    } else {
+        fprintf(file, "%.5f", value);
     }
-    
-    return kv;
 }
 
-COMLDEF Coml_Table* coml_new_table(const char* name, Coml_KV* items) {
-    Coml_Table* table = (Coml_Table*)malloc(sizeof(Coml_Table));
-    if (table != NULL) {
-        table->name = strdup(name);
-        table->items = items;
-        table->next = NULL;
+static void coml__format_key(FILE* file, const char* key) {
+    bool is_bare = key[0] != '\0';
+    for (const char* iter = key; *iter != '\0'; ++iter) {
+        if (!coml__is_bare_key_char(*iter)) is_bare = false;
+    }
+
+    if (is_bare) {
+        fprintf(file, "%s", key);
+    } else {
+        coml__format_string(file, key);
     }
-    
-    return table;
 }
 
-COMLDEF Coml_Table* coml_insert_table(Coml_Table* table, const char* name, Coml_KV* items) {
-    Coml_Table* new_table = coml_new_table(name, items);
-    if (new_table != NULL) {
-        new_table->next = table;
-        table = new_table;
+static void coml__format_path(FILE* file, const Coml__Path* path) {
+    if (path->parent != NULL) {
+        coml__format_path(file, path->parent);
+        fprintf(file, ".");
     }
-    
-    return table;
+
+    coml__format_key(file, path->name);
 }
 
-COMLDEF void* coml_get_value_raw(Coml* coml, Coml_Type type, const char* table_name, const char* key_name) {
-    Coml_Table* current_table = coml->tables;
-    while (current_table != NULL) {
-        if (strcmp(current_table->name, table_name) == 0) {
-            Coml_KV* kv = current_table->items;
-            while (kv != NULL) {
-                if (strcmp(kv->key, key_name) == 0) {
-                    if (kv->type != type) return NULL;
-                    return kv->value;
-                }
+static void coml__format_kvs(FILE* file, Coml_KV* kv, const char* newline);
+static void coml__format_tables(FILE* file, Coml_Table* table, const Coml__Path* parent, const char* newline);
 
-                kv = kv->next;
-            }
+static void coml__format_table(FILE* file, Coml_Table* table, const Coml__Path* parent, const char* newline) {
+    Coml__Path path = { table->name, parent, false, 0 };
+
+    if (table->is_array) {
+        for (size_t i = 0; i < table->array_length; ++i) {
+            Coml_Table* entry = coml__body(&table->array[i]);
+
+            fprintf(file, "[[");
+            coml__format_path(file, &path);
+            fprintf(file, "]]%s", newline);
+
+            coml__format_kvs(file, entry->items, newline);
+
+            fprintf(file, "%s", newline);
+
+            coml__format_tables(file, entry->tables, &path, newline);
         }
 
-        current_table = current_table->next;
+        return;
     }
 
-    return NULL;
-}
+    Coml_Table* body = coml__body(table);
 
-COMLDEF int coml_get_value_int(Coml* coml, const char* table_name, const char* key_name) {
-    void* value = coml_get_value_raw(coml, ComlType_Double, table_name, key_name);
-    if (value == NULL) return 0;
+    // Implicit parents are left out, their children's headers define them
+    if (body->items != NULL || body->tables == NULL) {
+        fprintf(file, "[");
+        coml__format_path(file, &path);
+        fprintf(file, "]%s", newline);
 
-    return (int)*(double*)value;
+        coml__format_kvs(file, body->items, newline);
+
+        fprintf(file, "%s", newline);
+    }
+
+    coml__format_tables(file, body->tables, &path, newline);
 }
 
-COMLDEF float coml_get_value_float(Coml* coml, const char* table_name, const char* key_name) {
+// Siblings are walked in a loop, only nesting recurses
+static void coml__format_tables(FILE* file, Coml_Table* table, const Coml__Path* parent, const char* newline) {
+    if (table == NULL) return;
+
+    Coml_Table* last = table;
+    while (last->next != NULL) last = last->next;
+
+    for (Coml_Table* iter = last;; iter = iter->prev) {
+        coml__format_table(file, iter, parent, newline);
+        if (iter == table) break;
+    }
+}
+
+static void coml__format_value(FILE* file, const Coml_KV* kv) {
+    switch (kv->type) {
+        case ComlType_Double:
+            coml__format_number(file, *(double*)kv->value);
+            break;
+        case ComlType_String:
+            coml__format_string(file, (char*)kv->value);
+            break;
+        case ComlType_Boolean:
+            fprintf(file, "%s", *(bool*)kv->value ? "true" : "false");
+            break;
+        case ComlType_ListDouble:
+            fprintf(file, "[");
+            for (size_t i = 0; i < kv->list_length; ++i) {
+                fprintf(file, " ");
+                coml__format_number(file, ((double*)kv->value)[i]);
+                fprintf(file, "%s", i == kv->list_length-1 ? "" : ","); 
+            }
+            fprintf(file, " ]");
+            break;
+        case ComlType_ListString:
+            fprintf(file, "[");
+            for (size_t i = 0; i < kv->list_length; ++i) {
+                fprintf(file, " ");
+                coml__format_string(file, ((char**)kv->value)[i]);
+                fprintf(file, "%s", i == kv->list_length-1 ? "" : ","); 
+            }
+            fprintf(file, " ]");
+            break;
+        default:
+            fprintf(file, "\"NULL (default)\""); 
+            break;
+    }
+}
+
+static void coml__format_kvs(FILE* file, Coml_KV* kv, const char* newline) {
+    if (kv == NULL) return;
+
+    Coml_KV* last = kv;
+    while (last->next != NULL) last = last->next;
+
+    for (Coml_KV* iter = last;; iter = iter->prev) {
+        coml__format_key(file, iter->key);
+        fprintf(file, " = ");
+        coml__format_value(file, iter);
+        fprintf(file, "%s", newline);
+
+        if (iter == kv) break;
+    }
+}
+
+COMLDEF void coml_format_kv(FILE* file, Coml_KV* kv) {
+    coml__format_kvs(file, kv, "\n");
+}
+
+COMLDEF void coml_format_table(FILE* file, Coml_Table* table) {
+    coml__format_tables(file, table, NULL, "\n");
+}
+
+typedef enum {
+    ComlPatch__Value, // Replaces the value of a changed KV
+    ComlPatch__Remove, // Drops the lines of a removed KV or table
+    ComlPatch__Key, // Inserts a new KV after the last line of its table
+    ComlPatch__Entry, // Appends a new array of tables entry at the end
+    ComlPatch__Header, // Appends the header of a new table without keys at the end
+} Coml__Patch_Kind;
+
+typedef struct {
+    size_t start;
+    size_t end;
+    size_t order; // Keeps patches at the same offset in document order
+    Coml__Patch_Kind kind;
+    const Coml_KV* kv;
+    const Coml_Table* entry;
+    Coml__Path* path; // Owned copy, relative to the table a new KV is written in, full for new entries
+} Coml__Patch;
+
+typedef struct {
+    Coml* coml;
+    Coml__Patch* patches;
+    size_t patches_length;
+    size_t patches_capacity;
+    bool is_failed;
+} Coml__Splicer;
+
+static void coml__free_path(const Coml_Allocator* allocator, Coml__Path* path) {
+    while (path != NULL) {
+        Coml__Path* parent = (Coml__Path*)path->parent;
+        coml__free(allocator, path, sizeof(Coml__Path));
+        path = parent;
+    }
+}
+
+// Paths are built on the stack while walking, patches outlive the walk
+static Coml__Path* coml__copy_path(const Coml_Allocator* allocator, const Coml__Path* path, bool* is_failed) {
+    if (path == NULL) return NULL;
+
+    Coml__Path* copy = (Coml__Path*)coml__alloc(allocator, sizeof(Coml__Path));
+    if (copy == NULL) {
+        *is_failed = true;
+        return NULL;
+    }
+
+    *copy = *path;
+    copy->parent = coml__copy_path(allocator, path->parent, is_failed);
+    if (path->parent != NULL && copy->parent == NULL) {
+        coml__free(allocator, copy, sizeof(Coml__Path));
+        return NULL;
+    }
+
+    return copy;
+}
+
+static void coml__add_patch(Coml__Splicer* splicer, Coml__Patch_Kind kind, size_t start, size_t end, const Coml_KV* kv, const Coml_Table* entry, const Coml__Path* path) {
+    if (splicer->is_failed) return;
+
+    const Coml_Allocator* allocator = &splicer->coml->allocator;
+    if (splicer->patches_length == splicer->patches_capacity) {
+        size_t new_capacity = splicer->patches_capacity == 0 ? 16 : splicer->patches_capacity*2;
+        Coml__Patch* new_patches = (Coml__Patch*)coml__realloc(allocator, splicer->patches, sizeof(Coml__Patch)*splicer->patches_capacity, sizeof(Coml__Patch)*new_capacity);
+        if (new_patches == NULL) {
+            splicer->is_failed = true;
+            return;
+        }
+
+        splicer->patches = new_patches;
+        splicer->patches_capacity = new_capacity;
+    }
+
+    Coml__Path* copy = coml__copy_path(allocator, path, &splicer->is_failed);
+    if (splicer->is_failed) return;
+
+    Coml__Patch patch = { start, end, splicer->patches_length, kind, kv, entry, copy };
+    splicer->patches[splicer->patches_length++] = patch;
+}
+
+// Spans of a table are in this source unless it is shared from another document
+static bool coml__has_spans(const Coml_Table* table) {
+    return (table->shared == NULL || table->is_own_shared) && coml__body(table)->header.end != 0;
+}
+
+// anchor is the closest table with a header (or the root), new KVs go after its last line with
+// relative as a dotted prefix. Tables shared from another document have no spans in this source.
+// New tables and entries go at append_end, the end of the file or, inside an array of tables entry,
+// the end of the entry, a header after the next entry would belong to that one.
+static void coml__splice_table(Coml__Splicer* splicer, const Coml_Table* table, const Coml_Table* anchor, const Coml__Path* relative, const Coml__Path* full, bool is_shared, size_t append_end) {
+    is_shared = is_shared || (table->shared != NULL && !table->is_own_shared);
+    const Coml_Table* body = coml__body(table);
+    size_t anchor_end = coml__body(anchor)->source_end;
+
+    // Without keys there is nothing to write under the anchor, coml_write_file gives these a header too
+    if (table != anchor && body->items == NULL && body->tables == NULL) {
+        coml__add_patch(splicer, ComlPatch__Header, append_end, append_end, NULL, NULL, full);
+        return;
+    }
+
+    const Coml_KV* kv = body->items;
+    while (kv != NULL && kv->next != NULL) kv = kv->next;
+    for (; kv != NULL; kv = kv->prev) {
+        if (!is_shared && kv->line.end != 0) {
+            if (kv->is_dirty) coml__add_patch(splicer, ComlPatch__Value, kv->span.start, kv->span.end, kv, NULL, NULL);
+        } else {
+            coml__add_patch(splicer, ComlPatch__Key, anchor_end, anchor_end, kv, NULL, relative);
+        }
+    }
+
+    const Coml_Table* child = body->tables;
+    while (child != NULL && child->next != NULL) child = child->next;
+    for (; child != NULL; child = child->prev) {
+        Coml__Path child_full = { child->name, full, false, 0 };
+
+        if (child->is_array) {
+            for (size_t i = 0; i < child->array_length; ++i) {
+                const Coml_Table* entry = &child->array[i];
+                if (!is_shared && coml__has_spans(entry)) {
+                    coml__splice_table(splicer, entry, entry, NULL, &child_full, false, coml__body(entry)->source_end);
+                } else {
+                    coml__add_patch(splicer, ComlPatch__Entry, append_end, append_end, NULL, entry, &child_full);
+                }
+            }
+        } else if (!is_shared && coml__has_spans(child)) {
+            coml__splice_table(splicer, child, child, NULL, &child_full, false, append_end);
+        } else {
+            Coml__Path child_relative = { child->name, relative, false, 0 };
+            coml__splice_table(splicer, child, anchor, &child_relative, &child_full, is_shared, append_end);
+        }
+    }
+}
+
+static int coml__compare_patches(const void* a, const void* b) {
+    const Coml__Patch* left = (const Coml__Patch*)a;
+    const Coml__Patch* right = (const Coml__Patch*)b;
+
+    if (left->start != right->start) return left->start < right->start ? -1 : 1;
+    // New entries and headers go after the KVs inserted at the end of the last table
+    bool is_left_appended = left->kind == ComlPatch__Entry || left->kind == ComlPatch__Header;
+    bool is_right_appended = right->kind == ComlPatch__Entry || right->kind == ComlPatch__Header;
+    if (is_left_appended != is_right_appended) return is_left_appended ? 1 : -1;
+    if (left->order != right->order) return left->order < right->order ? -1 : 1;
+    return 0;
+}
+
+// Copies the source and only writes the parts that changed, comments and formatting are kept
+static bool coml__write_spliced(Coml* coml, FILE* file) {
+    Coml__Splicer splicer;
+    memset(&splicer, 0, sizeof(Coml__Splicer));
+    splicer.coml = coml;
+
+    for (size_t i = 0; i < coml->removed_length; ++i) {
+        coml__add_patch(&splicer, ComlPatch__Remove, coml->removed[i].start, coml->removed[i].end, NULL, NULL, NULL);
+    }
+    coml__splice_table(&splicer, coml->root, coml->root, NULL, NULL, false, coml->source_length);
+
+    if (!splicer.is_failed && splicer.patches_length > 0) {
+        qsort(splicer.patches, splicer.patches_length, sizeof(Coml__Patch), coml__compare_patches);
+    }
+
+    const char* source = coml->source;
+    size_t pos = 0;
+    bool is_line_start = true;
+
+    // Inserted lines end like the first line of the source
+    const char* newline = "\n";
+    const char* first_newline = (const char*)memchr(source, '\n', coml->source_length);
+    if (first_newline != NULL && first_newline != source && first_newline[-1] == '\r') newline = "\r\n";
+    for (size_t i = 0; !splicer.is_failed && i < splicer.patches_length; ++i) {
+        const Coml__Patch* patch = &splicer.patches[i];
+        size_t start = patch->start < pos ? pos : patch->start;
+        if (start > pos) {
+            fwrite(source+pos, 1, start-pos, file);
+            is_line_start = source[start-1] == '\n';
+            pos = start;
+        }
+
+        switch (patch->kind) {
+            case ComlPatch__Value:
+                coml__format_value(file, patch->kv);
+                pos = patch->end;
+                break;
+            case ComlPatch__Remove:
+                if (patch->end > pos) pos = patch->end;
+                break;
+            case ComlPatch__Key:
+                if (!is_line_start) fprintf(file, "%s", newline);
+                if (patch->path != NULL) {
+                    coml__format_path(file, patch->path);
+                    fprintf(file, ".");
+                }
+                coml__format_key(file, patch->kv->key);
+                fprintf(file, " = ");
+                coml__format_value(file, patch->kv);
+                fprintf(file, "%s", newline);
+                is_line_start = true;
+                break;
+            case ComlPatch__Entry: {
+                const Coml_Table* entry = coml__body(patch->entry);
+
+                if (!is_line_start) fprintf(file, "%s", newline);
+                fprintf(file, "%s[[", newline);
+                coml__format_path(file, patch->path);
+                fprintf(file, "]]%s", newline);
+
+                coml__format_kvs(file, entry->items, newline);
+
+                if (entry->tables != NULL) fprintf(file, "%s", newline);
+                coml__format_tables(file, entry->tables, patch->path, newline);
+                is_line_start = true;
+            } break;
+            case ComlPatch__Header:
+                if (!is_line_start) fprintf(file, "%s", newline);
+                fprintf(file, "%s[", newline);
+                coml__format_path(file, patch->path);
+                fprintf(file, "]%s", newline);
+                is_line_start = true;
+                break;
+        }
+    }
+
+    if (!splicer.is_failed && pos < coml->source_length) {
+        fwrite(source+pos, 1, coml->source_length-pos, file);
+    }
+
+    for (size_t i = 0; i < splicer.patches_length; ++i) {
+        coml__free_path(&coml->allocator, splicer.patches[i].path);
+    }
+    coml__free(&coml->allocator, splicer.patches, sizeof(Coml__Patch)*splicer.patches_capacity);
+
+    return !splicer.is_failed && !ferror(file);
+}
+
+COMLDEF Coml* coml_parse(char* content, bool from_file) {
+    if (content == NULL) return NULL;
+
+    Coml* coml = coml_parse_ex(content, strlen(content), NULL, NULL);
+    if (from_file) COML_FREE(content);
+
+    return coml;
+}
+
+typedef struct {
+    size_t offset; // Where the segment starts in the input, for errors
+    size_t start; // Into the input, or into the scratch buffer if is_escaped
+    size_t length;
+    bool is_escaped;
+} Coml__Segment;
+
+typedef struct {
+    Coml* coml; // NULL when only a value is parsed
+    const Coml_Allocator* allocator;
+    const char* content;
+    size_t length;
+    size_t pos;
+    Coml_Table* current_table;
+    Coml_Error* error;
+    Coml__Segment* segments; // Segments of the last parsed key
+    size_t segments_length;
+    size_t segments_capacity;
+    char* scratch; // Quoted keys with escapes, decoded
+    size_t scratch_length;
+    size_t scratch_capacity;
+    Coml_KV* last_kv; // Parsed on the current line, its line span is finished at the line end
+    void* sink; // State of the handler, when converting without a Coml
+    const Coml_Limits* limits; // NULL for no limits
+    size_t nodes; // Keys and tables so far, for Coml_Limits.max_nodes
+} Coml__Parser;
+
+// Counts what is allocated against Coml_Limits.max_memory
+typedef struct {
+    Coml_Allocator inner;
+    size_t used;
+    size_t max_memory;
+    bool is_exceeded;
+} Coml__Budget;
+
+static void* coml__budget_alloc(void* context, size_t size) {
+    Coml__Budget* budget = (Coml__Budget*)context;
+    if (size > budget->max_memory-budget->used) {
+        budget->is_exceeded = true;
+        return NULL;
+    }
+
+    void* ptr = budget->inner.alloc(budget->inner.context, size);
+    if (ptr != NULL) budget->used += size;
+
+    return ptr;
+}
+
+static void* coml__budget_realloc(void* context, void* ptr, size_t old_size, size_t new_size) {
+    Coml__Budget* budget = (Coml__Budget*)context;
+    if (new_size > old_size && new_size-old_size > budget->max_memory-budget->used) {
+        budget->is_exceeded = true;
+        return NULL;
+    }
+
+    void* new_ptr = budget->inner.realloc(budget->inner.context, ptr, old_size, new_size);
+    if (new_ptr != NULL) budget->used = budget->used-(old_size < budget->used ? old_size : budget->used)+new_size;
+
+    return new_ptr;
+}
+
+static void coml__budget_free(void* context, void* ptr, size_t size) {
+    Coml__Budget* budget = (Coml__Budget*)context;
+    budget->used -= size < budget->used ? size : budget->used;
+    budget->inner.free(budget->inner.context, ptr, size);
+}
+
+// Returns allocator itself without a memory limit, budget has to outlive what is allocated through the result
+static Coml_Allocator coml__budget_allocator(Coml__Budget* budget, const Coml_Allocator* allocator, const Coml_Limits* limits) {
+    memset(budget, 0, sizeof(Coml__Budget));
+    if (limits == NULL || limits->max_memory == 0) return *allocator;
+
+    budget->inner = *allocator;
+    budget->max_memory = limits->max_memory;
+
+    Coml_Allocator limited = { coml__budget_alloc, coml__budget_realloc, coml__budget_free, budget };
+    return limited;
+}
+
+// The parser only sees an allocation failing, this tells it was the budget
+static void coml__budget_error(const Coml__Budget* budget, Coml_Error* error) {
+    if (!budget->is_exceeded || error == NULL) return;
+
+    error->code = ComlError_LimitExceeded;
+    error->message = "memory limit exceeded";
+}
+
+static bool coml__fail(Coml__Parser* parser, Coml_Error_Code code, size_t offset, const char* message) {
+    return coml__set_error(parser->error, code, offset, message);
+}
+
+static char coml__peek(const Coml__Parser* parser, size_t ahead) {
+    size_t pos = parser->pos+ahead;
+    return pos < parser->length ? parser->content[pos] : '\0';
+}
+
+static void coml__skip_space(Coml__Parser* parser) {
+    while (parser->pos < parser->length && coml__is_space(parser->content[parser->pos])) ++parser->pos;
+}
+
+static void coml__skip_comment(Coml__Parser* parser) {
+    if (coml__peek(parser, 0) != '#') return;
+
+    const char* newline = (const char*)memchr(parser->content+parser->pos, '\n', parser->length-parser->pos);
+    parser->pos = newline != NULL ? (size_t)(newline-parser->content) : parser->length;
+}
+
+// Spaces, comments and new lines, between statements and inside lists
+static void coml__skip_trivia(Coml__Parser* parser) {
+    while (true) {
+        coml__skip_space(parser);
+        coml__skip_comment(parser);
+        if (coml__peek(parser, 0) != '\n') return;
+        ++parser->pos;
+    }
+}
+
+static bool coml__expect_line_end(Coml__Parser* parser) {
+    coml__skip_space(parser);
+    coml__skip_comment(parser);
+    if (parser->pos == parser->length) return true;
+
+    if (parser->content[parser->pos] != '\n') {
+        return coml__fail(parser, ComlError_ExpectedNewLine, parser->pos, "expected a new line");
+    }
+
+    ++parser->pos;
+    return true;
+}
+
+static int coml__hex_value(char c) {
+    if (c >= '0' && c <= '9') return c-'0';
+    if (c >= 'a' && c <= 'f') return c-'a'+10;
+    if (c >= 'A' && c <= 'F') return c-'A'+10;
+
+    return -1;
+}
+
+static size_t coml__encode_utf8(unsigned long codepoint, char* out) {
+    char bytes[4];
+    size_t length = 0;
+
+    if (codepoint < 0x80) {
+        bytes[length++] = (char)codepoint;
+    } else if (codepoint < 0x800) {
+        bytes[length++] = (char)(0xC0 | (codepoint >> 6));
+        bytes[length++] = (char)(0x80 | (codepoint & 0x3F));
+    } else if (codepoint < 0x10000) {
+        bytes[length++] = (char)(0xE0 | (codepoint >> 12));
+        bytes[length++] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        bytes[length++] = (char)(0x80 | (codepoint & 0x3F));
+    } else {
+        bytes[length++] = (char)(0xF0 | (codepoint >> 18));
+        bytes[length++] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+        bytes[length++] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+        bytes[length++] = (char)(0x80 | (codepoint & 0x3F));
+    }
+
+    if (out != NULL) memcpy(out, bytes, length);
+
+    return length;
+}
+
+// Decodes the body of a basic string, out can be NULL to only measure it.
+// Stops once the length is over max_length, 0 for no limit.
+static bool coml__decode_basic(Coml__Parser* parser, size_t start, size_t end, bool is_multiline, size_t max_length, char* out, size_t* out_length) {
+    const char* content = parser->content;
+    size_t length = 0;
+    size_t i = start;
+
+    while (i < end && !coml__exceeds(max_length, length)) {
+        char c = content[i];
+        if (c != '\\') {
+            if (out != NULL) out[length] = c;
+            ++length;
+            ++i;
+            continue;
+        }
+
+        char escape = i+1 < end ? content[i+1] : '\0';
+
+        // A backslash at the end of a line trims all whitespace up to the next text
+        if (is_multiline && (coml__is_space(escape) || escape == '\n')) {
+            size_t j = i+1;
+            while (j < end && coml__is_space(content[j])) ++j;
+            if (j == end || content[j] != '\n') {
+                return coml__fail(parser, ComlError_InvalidValue, i, "invalid escape sequence");
+            }
+
+            while (j < end && (coml__is_space(content[j]) || content[j] == '\n')) ++j;
+            i = j;
+            continue;
+        }
+
+        char decoded = '\0';
+        switch (escape) {
+            case 'b': decoded = '\b'; break;
+            case 't': decoded = '\t'; break;
+            case 'n': decoded = '\n'; break;
+            case 'f': decoded = '\f'; break;
+            case 'r': decoded = '\r'; break;
+            case '"': decoded = '"'; break;
+            case '\\': decoded = '\\'; break;
+            case 'u':
+            case 'U': {
+                size_t digits = escape == 'u' ? 4 : 8;
+                if (i+2+digits > end) {
+                    return coml__fail(parser, ComlError_InvalidValue, i, "invalid unicode escape");
+                }
+
+                unsigned long codepoint = 0;
+                for (size_t k = 0; k < digits; ++k) {
+                    int digit = coml__hex_value(content[i+2+k]);
+                    if (digit < 0) return coml__fail(parser, ComlError_InvalidValue, i, "invalid unicode escape");
+                    codepoint = codepoint*16+(unsigned long)digit;
+                }
+
+                // NUL can't be represented in the returned C strings
+                if (codepoint == 0 || (codepoint >= 0xD800 && codepoint <= 0xDFFF) || codepoint > 0x10FFFF) {
+                    return coml__fail(parser, ComlError_InvalidValue, i, "invalid unicode escape");
+                }
+
+                length += coml__encode_utf8(codepoint, out != NULL ? out+length : NULL);
+                i += 2+digits;
+                continue;
+            }
+            default:
+                return coml__fail(parser, ComlError_InvalidValue, i, "invalid escape sequence");
+        }
+
+        if (out != NULL) out[length] = decoded;
+        ++length;
+        i += 2;
+    }
+
+    *out_length = length;
+    return true;
+}
+
+// Finds the body of the string starting at parser->pos and moves past its closing quotes
+static bool coml__scan_string(Coml__Parser* parser, bool allow_multiline, size_t* body_start, size_t* body_end, bool* is_basic, bool* is_multiline) {
+    const char* content = parser->content;
+    size_t open = parser->pos;
+    char quote = content[open];
+
+    *is_basic = quote == '"';
+    *is_multiline = allow_multiline && coml__peek(parser, 1) == quote && coml__peek(parser, 2) == quote;
+
+    if (*is_multiline) {
+        size_t i = open+3;
+
+        // A new line right after the opening quotes isn't part of the string
+        if (i < parser->length && content[i] == '\n') {
+            i += 1;
+        } else if (i+1 < parser->length && content[i] == '\r' && content[i+1] == '\n') {
+            i += 2;
+        }
+
+        *body_start = i;
+        while (i < parser->length) {
+            if (content[i] == '\\' && *is_basic) {
+                i += 2;
+                continue;
+            }
+
+            if (content[i] == quote && i+2 < parser->length && content[i+1] == quote && content[i+2] == quote) {
+                // Up to two quotes right before the closing ones belong to the string
+                size_t run = 3;
+                while (i+run < parser->length && content[i+run] == quote) ++run;
+                if (run > 5) return coml__fail(parser, ComlError_InvalidValue, i, "too many quotes at the end of a string");
+
+                *body_end = i+run-3;
+                parser->pos = i+run;
+                return true;
+            }
+
+            ++i;
+        }
+
+        return coml__fail(parser, ComlError_UnterminatedString, open, "unterminated string");
+    }
+
+    size_t i = open+1;
+    *body_start = i;
+    while (i < parser->length && content[i] != '\n') {
+        if (content[i] == '\\' && *is_basic) {
+            i += 2;
+            continue;
+        }
+
+        if (content[i] == quote) {
+            *body_end = i;
+            parser->pos = i+1;
+            return true;
+        }
+
+        ++i;
+    }
+
+    return coml__fail(parser, ComlError_UnterminatedString, open, "unterminated string");
+}
+
+static bool coml__parse_string(Coml__Parser* parser, char** out) {
+    size_t open = parser->pos;
+    size_t body_start = 0;
+    size_t body_end = 0;
+    bool is_basic = false;
+    bool is_multiline = false;
+    if (!coml__scan_string(parser, true, &body_start, &body_end, &is_basic, &is_multiline)) return false;
+
+    // Decoding never makes a string longer, only a body over the limit has to be measured, and
+    // only up to the limit. Literal strings are their body.
+    size_t length = body_end-body_start;
+    size_t max_length = parser->limits != NULL ? parser->limits->max_string_length : 0;
+    if (coml__exceeds(max_length, length)) {
+        if (is_basic && !coml__decode_basic(parser, body_start, body_end, is_multiline, max_length, NULL, &length)) return false;
+        if (coml__exceeds(max_length, length)) return coml__fail(parser, ComlError_LimitExceeded, open, "string is too long");
+    }
+
+    if (is_basic && !coml__decode_basic(parser, body_start, body_end, is_multiline, 0, NULL, &length)) return false;
+
+    char* string = (char*)coml__alloc(parser->allocator, length+1);
+    if (string == NULL) return coml__fail(parser, ComlError_OutOfMemory, open, "out of memory");
+
+    if (is_basic) {
+        coml__decode_basic(parser, body_start, body_end, is_multiline, 0, string, &length);
+    } else {
+        memcpy(string, parser->content+body_start, length);
+    }
+    string[length] = '\0';
+
+    if (strlen(string) != length) {
+        coml__free(parser->allocator, string, length+1);
+        return coml__fail(parser, ComlError_InvalidValue, open, "strings can't contain NUL");
+    }
+
+    *out = string;
+    return true;
+}
+
+static bool coml__is_value_end(char c) {
+    return c == '\0' || c == '\n' || c == ',' || c == ']' || c == '}' || c == '#' || coml__is_space(c);
+}
+
+static bool coml__parse_number(Coml__Parser* parser, double* out) {
+    const char* content = parser->content;
+    size_t start = parser->pos;
+    while (parser->pos < parser->length && !coml__is_value_end(content[parser->pos])) ++parser->pos;
+
+    const char* token = content+start;
+    size_t length = parser->pos-start;
+    if (length == 0) return coml__fail(parser, ComlError_InvalidValue, start, "expected a value");
+
+    if (memchr(token, ':', length) != NULL || (length >= 10 && token[4] == '-' && token[7] == '-')) {
+        return coml__fail(parser, ComlError_Unsupported, start, "dates and times are not supported");
+    }
+
+    size_t i = 0;
+    bool is_negative = false;
+    if (token[0] == '+' || token[0] == '-') {
+        is_negative = token[0] == '-';
+        i = 1;
+    }
+
+    if (length-i == 3 && (strncmp(token+i, "inf", 3) == 0 || strncmp(token+i, "nan", 3) == 0)) {
+        double special = token[i] == 'i' ? INFINITY : NAN;
+        *out = is_negative ? -special : special;
+        return true;
+    }
+
+    // 0x, 0o and 0b integers, without a sign
+    if (i == 0 && length > 2 && token[0] == '0' && (token[1] == 'x' || token[1] == 'o' || token[1] == 'b')) {
+        int base = token[1] == 'x' ? 16 : token[1] == 'o' ? 8 : 2;
+        double value = 0;
+        bool was_digit = false;
+
+        for (size_t k = 2; k < length; ++k) {
+            if (token[k] == '_' && was_digit && k+1 < length) {
+                was_digit = false;
+                continue;
+            }
+
+            int digit = coml__hex_value(token[k]);
+            if (digit < 0 || digit >= base) return coml__fail(parser, ComlError_InvalidValue, start, "invalid number");
+
+            value = value*base+digit;
+            was_digit = true;
+        }
+
+        if (!was_digit) return coml__fail(parser, ComlError_InvalidValue, start, "invalid number");
+
+        *out = value;
+        return true;
+    }
+
+    // Copy without underscores so strtod can read it, numbers are short so it fits on the stack
+    char buffer[128];
+    size_t buffer_length = 0;
+    for (size_t k = 0; k < length; ++k) {
+        char c = token[k];
+        bool is_digit = c >= '0' && c <= '9';
+
+        if (c == '_') {
+            bool digit_before = k > 0 && token[k-1] >= '0' && token[k-1] <= '9';
+            bool digit_after = k+1 < length && token[k+1] >= '0' && token[k+1] <= '9';
+            if (!digit_before || !digit_after) return coml__fail(parser, ComlError_InvalidValue, start, "invalid number");
+            continue;
+        }
+
+        if (!is_digit && c != '.' && c != 'e' && c != 'E' && c != '+' && c != '-') {
+            return coml__fail(parser, ComlError_InvalidValue, start, "invalid value");
+        }
+
+        if (buffer_length == sizeof(buffer)-1) return coml__fail(parser, ComlError_InvalidValue, start, "number is too long");
+        buffer[buffer_length++] = c;
+    }
+    buffer[buffer_length] = '\0';
+
+    char* end = NULL;
+    *out = strtod(buffer, &end);
+    if (buffer_length == 0 || *end != '\0') return coml__fail(parser, ComlError_InvalidValue, start, "invalid number");
+
+    return true;
+}
+
+static bool coml__parse_bool(Coml__Parser* parser, bool* out) {
+    const char* token = parser->content+parser->pos;
+    size_t left = parser->length-parser->pos;
+
+    if (left >= 4 && strncmp(token, "true", 4) == 0 && coml__is_value_end(coml__peek(parser, 4))) {
+        *out = true;
+        parser->pos += 4;
+        return true;
+    }
+
+    if (left >= 5 && strncmp(token, "false", 5) == 0 && coml__is_value_end(coml__peek(parser, 5))) {
+        *out = false;
+        parser->pos += 5;
+        return true;
+    }
+
+    return false;
+}
+
+static bool coml__parse_list(Coml__Parser* parser, Coml_KV* kv) {
+    const Coml_Allocator* allocator = parser->allocator;
+    size_t open = parser->pos;
+    void* items = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    bool has_type = false;
+    bool res = true;
+
+    kv->type = ComlType_ListDouble;
+    ++parser->pos;
+
+    while (true) {
+        coml__skip_trivia(parser);
+
+        char c = coml__peek(parser, 0);
+        if (c == ']') {
+            ++parser->pos;
+            break;
+        }
+
+        if (parser->pos == parser->length) {
+            res = coml__fail(parser, ComlError_InvalidValue, open, "expected ']' to close the list");
+            break;
+        }
+
+        if (c == '[' || c == '{') {
+            res = coml__fail(parser, ComlError_Unsupported, parser->pos, "nested lists and inline tables are not supported");
+            break;
+        }
+
+        bool is_string = c == '"' || c == '\'';
+        if (!has_type) {
+            kv->type = is_string ? ComlType_ListString : ComlType_ListDouble;
+            has_type = true;
+        } else if (is_string != (kv->type == ComlType_ListString)) {
+            res = coml__fail(parser, ComlError_Unsupported, parser->pos, "lists with mixed types are not supported");
+            break;
+        }
+
+        if (parser->limits != NULL && coml__exceeds(parser->limits->max_list_length, length+1)) {
+            res = coml__fail(parser, ComlError_LimitExceeded, parser->pos, "list is too long");
+            break;
+        }
+
+        size_t item_size = is_string ? sizeof(char*) : sizeof(double);
+        if (length == capacity) {
+            size_t new_capacity = capacity == 0 ? 4 : capacity*2;
+            void* new_items = coml__realloc(allocator, items, item_size*capacity, item_size*new_capacity);
+            if (new_items == NULL) {
+                res = coml__fail(parser, ComlError_OutOfMemory, parser->pos, "out of memory");
+                break;
+            }
+
+            items = new_items;
+            capacity = new_capacity;
+        }
+
+        bool unused = false;
+        if (is_string) {
+            res = coml__parse_string(parser, &((char**)items)[length]);
+        } else if (coml__parse_bool(parser, &unused)) {
+            res = coml__fail(parser, ComlError_Unsupported, parser->pos-(unused ? 4 : 5), "lists of booleans are not supported");
+        } else {
+            res = coml__parse_number(parser, &((double*)items)[length]);
+        }
+        if (!res) break;
+        ++length;
+
+        coml__skip_trivia(parser);
+        c = coml__peek(parser, 0);
+        if (c == ',') {
+            ++parser->pos;
+        } else if (parser->pos == parser->length) {
+            res = coml__fail(parser, ComlError_InvalidValue, open, "expected ']' to close the list");
+            break;
+        } else if (c != ']') {
+            res = coml__fail(parser, ComlError_InvalidValue, parser->pos, "expected ',' or ']' in list");
+            break;
+        }
+    }
+
+    size_t item_size = kv->type == ComlType_ListString ? sizeof(char*) : sizeof(double);
+
+    if (!res) {
+        if (kv->type == ComlType_ListString) {
+            for (size_t i = 0; i < length; ++i) coml__free_string(allocator, ((char**)items)[i]);
+        }
+        coml__free(allocator, items, item_size*capacity);
+        return false;
+    }
+
+    // Shrink to the exact size, it's what gets reported when freeing
+    if (length == 0) {
+        coml__free(allocator, items, item_size*capacity);
+        items = NULL;
+    } else if (length != capacity) {
+        void* new_items = coml__realloc(allocator, items, item_size*capacity, item_size*length);
+        if (new_items == NULL) {
+            if (kv->type == ComlType_ListString) {
+                for (size_t i = 0; i < length; ++i) coml__free_string(allocator, ((char**)items)[i]);
+            }
+            coml__free(allocator, items, item_size*capacity);
+            return coml__fail(parser, ComlError_OutOfMemory, open, "out of memory");
+        }
+        items = new_items;
+    }
+
+    kv->value = items;
+    kv->list_length = length;
+
+    return true;
+}
+
+static bool coml__parse_value(Coml__Parser* parser, Coml_KV* kv) {
+    size_t start = parser->pos;
+    char c = coml__peek(parser, 0);
+
+    kv->value = NULL;
+    kv->list_length = 0;
+
+    if (parser->pos == parser->length || c == '\n' || c == '#') {
+        return coml__fail(parser, ComlError_InvalidValue, start, "expected a value");
+    }
+
+    if (c == '"' || c == '\'') {
+        kv->type = ComlType_String;
+        return coml__parse_string(parser, (char**)&kv->value);
+    }
+
+    if (c == '[') return coml__parse_list(parser, kv);
+
+    if (c == '{') return coml__fail(parser, ComlError_Unsupported, start, "inline tables are not supported");
+
+    bool boolean = false;
+    if (coml__parse_bool(parser, &boolean)) {
+        kv->value = coml__alloc(parser->allocator, sizeof(bool));
+        if (kv->value == NULL) return coml__fail(parser, ComlError_OutOfMemory, start, "out of memory");
+
+        *((bool*)kv->value) = boolean;
+        kv->type = ComlType_Boolean;
+        return true;
+    }
+
+    double number = 0;
+    if (!coml__parse_number(parser, &number)) return false;
+
+    kv->value = coml__alloc(parser->allocator, sizeof(double));
+    if (kv->value == NULL) return coml__fail(parser, ComlError_OutOfMemory, start, "out of memory");
+
+    *((double*)kv->value) = number;
+    kv->type = ComlType_Double;
+
+    return true;
+}
+
+static const char* coml__segment_key(const Coml__Parser* parser, const Coml__Segment* segment) {
+    return segment->is_escaped ? parser->scratch+segment->start : parser->content+segment->start;
+}
+
+// Reads a dotted key into parser->segments
+static bool coml__parse_key(Coml__Parser* parser) {
+    const Coml_Allocator* allocator = parser->allocator;
+
+    parser->segments_length = 0;
+    parser->scratch_length = 0;
+
+    while (true) {
+        coml__skip_space(parser);
+
+        if (parser->limits != NULL && coml__exceeds(parser->limits->max_depth, parser->segments_length+1)) {
+            return coml__fail(parser, ComlError_LimitExceeded, parser->pos, "key is nested too deeply");
+        }
+
+        if (parser->segments_length == parser->segments_capacity) {
+            size_t new_capacity = parser->segments_capacity == 0 ? 8 : parser->segments_capacity*2;
+            Coml__Segment* new_segments = (Coml__Segment*)coml__realloc(allocator, parser->segments, sizeof(Coml__Segment)*parser->segments_capacity, sizeof(Coml__Segment)*new_capacity);
+            if (new_segments == NULL) return coml__fail(parser, ComlError_OutOfMemory, parser->pos, "out of memory");
+
+            parser->segments = new_segments;
+            parser->segments_capacity = new_capacity;
+        }
+
+        Coml__Segment segment = { parser->pos, parser->pos, 0, false };
+        char c = coml__peek(parser, 0);
+
+        if (c == '"' || c == '\'') {
+            size_t body_start = 0;
+            size_t body_end = 0;
+            bool is_basic = false;
+            bool is_multiline = false;
+            if (!coml__scan_string(parser, false, &body_start, &body_end, &is_basic, &is_multiline)) return false;
+
+            segment.start = body_start;
+            segment.length = body_end-body_start;
+
+            // Like strings, a body over the limit is measured up to the limit before anything is decoded
+            size_t max_length = parser->limits != NULL ? parser->limits->max_string_length : 0;
+            if (is_basic && coml__exceeds(max_length, segment.length)) {
+                size_t decoded_length = 0;
+                if (!coml__decode_basic(parser, body_start, body_end, false, max_length, NULL, &decoded_length)) return false;
+                if (coml__exceeds(max_length, decoded_length)) return coml__fail(parser, ComlError_LimitExceeded, segment.offset, "key is too long");
+            }
+
+            if (is_basic && memchr(parser->content+body_start, '\\', segment.length) != NULL) {
+                size_t decoded_length = 0;
+                if (!coml__decode_basic(parser, body_start, body_end, false, 0, NULL, &decoded_length)) return false;
+
+                if (parser->scratch_length+decoded_length > parser->scratch_capacity) {
+                    size_t new_capacity = (parser->scratch_length+decoded_length)*2;
+                    char* new_scratch = (char*)coml__realloc(allocator, parser->scratch, parser->scratch_capacity, new_capacity);
+                    if (new_scratch == NULL) return coml__fail(parser, ComlError_OutOfMemory, segment.offset, "out of memory");
+
+                    parser->scratch = new_scratch;
+                    parser->scratch_capacity = new_capacity;
+                }
+
+                coml__decode_basic(parser, body_start, body_end, false, 0, parser->scratch+parser->scratch_length, &decoded_length);
+                segment.start = parser->scratch_length;
+                segment.length = decoded_length;
+                segment.is_escaped = true;
+                parser->scratch_length += decoded_length;
+            }
+
+            if (memchr(coml__segment_key(parser, &segment), '\0', segment.length) != NULL) {
+                return coml__fail(parser, ComlError_InvalidKey, segment.offset, "keys can't contain NUL");
+            }
+        } else {
+            while (parser->pos < parser->length && coml__is_bare_key_char(parser->content[parser->pos])) ++parser->pos;
+            segment.length = parser->pos-segment.start;
+            if (segment.length == 0) return coml__fail(parser, ComlError_InvalidKey, parser->pos, "expected a key");
+        }
+
+        if (parser->limits != NULL && coml__exceeds(parser->limits->max_string_length, segment.length)) {
+            return coml__fail(parser, ComlError_LimitExceeded, segment.offset, "key is too long");
+        }
+
+        parser->segments[parser->segments_length++] = segment;
+
+        coml__skip_space(parser);
+        if (coml__peek(parser, 0) != '.') return true;
+        ++parser->pos;
+    }
+}
+
+// Finds or creates the child table for one segment of a dotted key, is_dotted is set for the keys
+// of a key = value line, which can only go into tables made by other dotted keys
+static Coml_Table* coml__parser_descend(Coml__Parser* parser, Coml_Table* table, const Coml__Segment* segment, bool is_dotted) {
+    const char* key = coml__segment_key(parser, segment);
+
+    Coml_Index_Slot* slot = coml__index_find(&table->index, key, segment->length, coml__hash(key, segment->length));
+    if (slot != NULL) {
+        if (!slot->is_table) {
+            coml__fail(parser, ComlError_DuplicateKey, segment->offset, "key is already defined as a value");
+            return NULL;
+        }
+
+        Coml_Table* child = (Coml_Table*)slot->node;
+        if (is_dotted && child->is_array) {
+            coml__fail(parser, ComlError_DuplicateKey, segment->offset, "key is already defined as an array of tables");
+            return NULL;
+        }
+        if (is_dotted && !child->is_dotted) {
+            coml__fail(parser, ComlError_DuplicateKey, segment->offset, "table is already defined by a header");
+            return NULL;
+        }
+
+        // Headers after [[name]] extend its last entry
+        if (child->is_array) return &child->array[child->array_length-1];
+
+        return child;
+    }
+
+    char* name = coml__strndup(parser->allocator, key, segment->length);
+    Coml_Table* child = name != NULL ? coml_insert_table(parser->allocator, table, name) : NULL;
+    coml__free_string(parser->allocator, name);
+
+    if (child == NULL) {
+        coml__fail(parser, ComlError_OutOfMemory, segment->offset, "out of memory");
+        return NULL;
+    }
+
+    // Defined here, like the streaming converter does, so a later [header] for it fails
+    child->is_dotted = is_dotted;
+    child->is_defined = is_dotted;
+
+    return child;
+}
+
+// The syntax of a [header], the key is left in parser->segments
+static bool coml__scan_header(Coml__Parser* parser, bool* is_array) {
+    *is_array = coml__peek(parser, 1) == '[';
+    parser->pos += *is_array ? 2 : 1;
+
+    if (!coml__parse_key(parser)) return false;
+
+    if (coml__peek(parser, 0) != ']' || (*is_array && coml__peek(parser, 1) != ']')) {
+        return coml__fail(parser, ComlError_InvalidTable, parser->pos, *is_array ? "expected ']]' after table name" : "expected ']' after table name");
+    }
+    parser->pos += *is_array ? 2 : 1;
+
+    return true;
+}
+
+static bool coml__build_header(Coml__Parser* parser, size_t start, bool is_array) {
+    Coml_Table* table = parser->coml->root;
+    for (size_t i = 0; i+1 < parser->segments_length; ++i) {
+        table = coml__parser_descend(parser, table, &parser->segments[i], false);
+        if (table == NULL) return false;
+    }
+
+    const Coml__Segment* segment = &parser->segments[parser->segments_length-1];
+    const char* key = coml__segment_key(parser, segment);
+    Coml_Index_Slot* slot = coml__index_find(&table->index, key, segment->length, coml__hash(key, segment->length));
+    if (slot != NULL && !slot->is_table) {
+        return coml__fail(parser, ComlError_DuplicateKey, segment->offset, "key is already defined as a value");
+    }
+    if (slot != NULL && ((Coml_Table*)slot->node)->is_array != is_array) {
+        return coml__fail(parser, ComlError_DuplicateKey, segment->offset, is_array ? "table is already defined as a plain table" : "table is already defined as an array of tables");
+    }
+
+    if (is_array) {
+        char* name = coml__strndup(parser->allocator, key, segment->length);
+        table = name != NULL ? coml_append_table_array(parser->allocator, table, name) : NULL;
+        coml__free_string(parser->allocator, name);
+        if (table == NULL) return coml__fail(parser, ComlError_OutOfMemory, start, "out of memory");
+    } else {
+        table = coml__parser_descend(parser, table, segment, false);
+        if (table == NULL) return false;
+
+        if (table->is_defined) {
+            return coml__fail(parser, ComlError_DuplicateKey, start, "table is defined more than once");
+        }
+    }
+
+    table->is_defined = true;
+    table->header.start = start;
+    parser->current_table = table;
+
+    return true;
+}
+
+// The syntax of a key = value line, the key is left in parser->segments
+static bool coml__scan_kv(Coml__Parser* parser, Coml_KV* value) {
+    size_t start = parser->pos;
+
+    if (!coml__parse_key(parser)) return false;
+
+    if (coml__peek(parser, 0) != '=') {
+        return coml__fail(parser, ComlError_ExpectedEquals, parser->pos, "expected '=' after key");
+    }
+    ++parser->pos;
+    coml__skip_space(parser);
+
+    memset(value, 0, sizeof(Coml_KV));
+    value->span.start = parser->pos;
+    if (!coml__parse_value(parser, value)) return false;
+    value->span.end = parser->pos;
+    value->line.start = start;
+
+    return true;
+}
+
+// Moves value into a new KV in table, the key must not be in the table yet. value is freed if it fails.
+static Coml_KV* coml__attach_kv(const Coml_Allocator* allocator, Coml_Table* table, const char* key, size_t length, Coml_KV* value) {
+    Coml_KV* kv = (Coml_KV*)coml__alloc(allocator, sizeof(Coml_KV));
+    char* kv_key = coml__strndup(allocator, key, length);
+    if (kv == NULL || kv_key == NULL) {
+        coml__free(allocator, kv, sizeof(Coml_KV));
+        coml__free_string(allocator, kv_key);
+        coml__free_value(allocator, value->type, value->value, value->list_length);
+        return NULL;
+    }
+
+    *kv = *value;
+    kv->key = kv_key;
+
+    if (!coml__index_insert(allocator, &table->index, kv->key, kv, false)) {
+        coml_free_kv(allocator, kv);
+        return NULL;
+    }
+
+    coml__push_kv(table, kv);
+
+    return kv;
+}
+
+static bool coml__build_kv(Coml__Parser* parser, size_t start, Coml_KV* value) {
+    const Coml_Allocator* allocator = parser->allocator;
+
+    // Dotted keys create the tables in between
+    Coml_Table* table = parser->current_table;
+    for (size_t i = 0; i+1 < parser->segments_length; ++i) {
+        table = coml__parser_descend(parser, table, &parser->segments[i], true);
+        if (table == NULL) {
+            coml__free_value(allocator, value->type, value->value, value->list_length);
+            return false;
+        }
+    }
+
+    const Coml__Segment* segment = &parser->segments[parser->segments_length-1];
+    const char* key = coml__segment_key(parser, segment);
+    if (coml__index_find(&table->index, key, segment->length, coml__hash(key, segment->length)) != NULL) {
+        coml__free_value(allocator, value->type, value->value, value->list_length);
+        return coml__fail(parser, ComlError_DuplicateKey, segment->offset, "key is defined more than once");
+    }
+
+    parser->last_kv = coml__attach_kv(allocator, table, key, segment->length, value);
+    if (parser->last_kv == NULL) return coml__fail(parser, ComlError_OutOfMemory, start, "out of memory");
+
+    return true;
+}
+
+// Receives the lines of a document, the tree builder or the JSON converter
+typedef struct {
+    bool (*header)(Coml__Parser* parser, size_t start, bool is_array);
+    bool (*kv)(Coml__Parser* parser, size_t start, Coml_KV* value); // Owns the contents of value
+} Coml__Handler;
+
+// Every segment of the last key can create a table or a key
+static bool coml__count_nodes(Coml__Parser* parser, size_t start) {
+    parser->nodes += parser->segments_length;
+    if (parser->limits != NULL && coml__exceeds(parser->limits->max_nodes, parser->nodes)) {
+        return coml__fail(parser, ComlError_LimitExceeded, start, "too many keys and tables");
+    }
+
+    return true;
+}
+
+static bool coml__parse_lines(Coml__Parser* parser, const Coml__Handler* handler) {
+    while (true) {
+        coml__skip_trivia(parser);
+        if (parser->pos == parser->length) return true;
+
+        size_t start = parser->pos;
+        parser->last_kv = NULL;
+        bool is_header = parser->content[start] == '[';
+        if (is_header) {
+            bool is_array = false;
+            if (!coml__scan_header(parser, &is_array) || !coml__count_nodes(parser, start) || !handler->header(parser, start, is_array)) return false;
+        } else {
+            Coml_KV value;
+            if (!coml__scan_kv(parser, &value)) return false;
+            if (!coml__count_nodes(parser, start)) {
+                coml__free_value(parser->allocator, value.type, value.value, value.list_length);
+                return false;
+            }
+            if (!handler->kv(parser, start, &value)) return false;
+        }
+
+        if (!coml__expect_line_end(parser)) return false;
+
+        if (parser->coml != NULL) {
+            if (is_header) parser->current_table->header.end = parser->pos;
+            if (parser->last_kv != NULL) parser->last_kv->line.end = parser->pos;
+            parser->current_table->source_end = parser->pos;
+        }
+    }
+}
+
+static void coml__parser_free(Coml__Parser* parser) {
+    coml__free(parser->allocator, parser->segments, sizeof(Coml__Segment)*parser->segments_capacity);
+    coml__free(parser->allocator, parser->scratch, parser->scratch_capacity);
+}
+
+COMLDEF Coml* coml_parse_ex(const char* content, size_t length, const Coml_Options* options, Coml_Error* error) {
+    coml__set_error(error, ComlError_None, 0, NULL);
+
+    if (content == NULL || length == 0) {
+        coml__set_error(error, ComlError_EmptyInput, 0, "empty input");
+        return NULL;
+    }
+
+    const Coml_Limits* limits = options != NULL ? options->limits : NULL;
+    if (limits != NULL && coml__exceeds(limits->max_input_bytes, length)) {
+        coml__set_error(error, ComlError_LimitExceeded, 0, "input is too large");
+        return NULL;
+    }
+
+    Coml* coml = coml_new(options);
+    if (coml == NULL) {
+        coml__set_error(error, ComlError_OutOfMemory, 0, "out of memory");
+        return NULL;
+    }
+
+    // Everything is allocated through the budget while parsing, the document keeps the real allocator
+    Coml__Budget budget;
+    Coml_Allocator allocator = coml->allocator;
+    coml->allocator = coml__budget_allocator(&budget, &allocator, limits);
+
+    Coml__Parser parser;
+    memset(&parser, 0, sizeof(Coml__Parser));
+    parser.coml = coml;
+    parser.allocator = &coml->allocator;
+    parser.content = content;
+    parser.length = length;
+    parser.current_table = coml->root;
+    parser.error = error;
+    parser.limits = limits;
+
+    Coml__Handler handler = { coml__build_header, coml__build_kv };
+    bool res = coml__parse_lines(&parser, &handler);
+
+    coml__parser_free(&parser);
+
+    if (res && options != NULL && options->keep_source) {
+        coml->source = (char*)coml__alloc(&coml->allocator, length);
+        if (coml->source == NULL) {
+            res = coml__set_error(error, ComlError_OutOfMemory, 0, "out of memory");
+        } else {
+            memcpy(coml->source, content, length);
+            coml->source_length = length;
+        }
+    }
+
+    coml->allocator = allocator;
+
+    if (!res) {
+        coml__budget_error(&budget, error);
+        coml__locate_error(error, content, length);
+        coml_free(coml);
+        return NULL;
+    }
+
+    return coml;
+}
+
+COMLDEF Coml* coml_new(const Coml_Options* options) {
+    Coml_Allocator allocator = options != NULL && options->allocator != NULL ? *options->allocator : coml_default_allocator();
+
+    Coml* coml = (Coml*)coml__alloc(&allocator, sizeof(Coml));
+    if (coml == NULL) return NULL;
+
+    memset(coml, 0, sizeof(Coml));
+    coml->allocator = allocator;
+    coml->refs = 1;
+    coml->root = coml_new_table(&coml->allocator, "");
+
+    if (coml->root == NULL) {
+        coml_free(coml);
+        return NULL;
+    }
+
+    return coml;
+}
+
+static void coml__forget_source(Coml* coml) {
+    coml__free(&coml->allocator, coml->source, coml->source_length);
+    coml__free(&coml->allocator, coml->removed, sizeof(Coml_Span)*coml->removed_capacity);
+    coml->source = NULL;
+    coml->source_length = 0;
+    coml->removed = NULL;
+    coml->removed_length = 0;
+    coml->removed_capacity = 0;
+}
+
+COMLDEF void coml_free(Coml* coml) {
+    if (coml == NULL) return;
+
+    coml->refs -= 1;
+    if (coml->refs > 0) return;
+
+    Coml_Allocator allocator = coml->allocator;
+
+    coml_free_table(&allocator, coml->root);
+    for (size_t i = 0; i < coml->sources_length; ++i) {
+        coml_free(coml->sources[i]);
+    }
+    coml__free(&allocator, coml->sources, sizeof(Coml*)*coml->sources_capacity);
+    coml__forget_source(coml);
+    coml__free(&allocator, coml, sizeof(Coml));
+}
+
+COMLDEF bool coml_parse_value(const Coml_Allocator* allocator, Coml_KV* kv, const char *input) {
+    Coml__Parser parser;
+    memset(&parser, 0, sizeof(Coml__Parser));
+    parser.allocator = allocator;
+    parser.content = input;
+    parser.length = strlen(input);
+
+    coml__skip_space(&parser);
+    if (!coml__parse_value(&parser, kv)) return false;
+
+    coml__skip_space(&parser);
+    if (parser.pos != parser.length) {
+        coml__free_value(allocator, kv->type, kv->value, kv->list_length);
+        kv->value = NULL;
+        kv->list_length = 0;
+        return false;
+    }
+
+    return true;
+}
+
+COMLDEF Coml_KV* coml_new_kv(const Coml_Allocator* allocator, const char* key, const char* value) {
+    Coml_KV* kv = (Coml_KV*)coml__alloc(allocator, sizeof(Coml_KV));
+    if (kv == NULL) return NULL;
+
+    memset(kv, 0, sizeof(Coml_KV));
+    kv->key = coml__strdup(allocator, key);
+
+    if (kv->key == NULL || !coml_parse_value(allocator, kv, value)) {
+        coml__free_string(allocator, kv->key);
+        coml__free(allocator, kv, sizeof(Coml_KV));
+        return NULL;
+    }
+    
+    return kv;
+}
+
+COMLDEF Coml_KV* coml_insert_kv(const Coml_Allocator* allocator, Coml_Table* table, const char* key, const char* value) {
+    if (table == NULL || !coml__materialize(allocator, table)) return NULL;
+    if (coml__index_find(&table->index, key, strlen(key), coml__hash(key, strlen(key))) != NULL) return NULL;
+
+    Coml_KV* new_kv = coml_new_kv(allocator, key, value);
+    if (new_kv == NULL) return NULL;
+
+    if (!coml__index_insert(allocator, &table->index, new_kv->key, new_kv, false)) {
+        coml_free_kv(allocator, new_kv);
+        return NULL;
+    }
+
+    coml__push_kv(table, new_kv);
+    
+    return new_kv;
+}
+
+COMLDEF void coml_free_kv(const Coml_Allocator* allocator, Coml_KV* kv) {
+    if (kv == NULL) return;
+
+    coml__free_string(allocator, kv->key);
+    coml__free_value(allocator, kv->type, kv->value, kv->list_length);
+    coml__free(allocator, kv, sizeof(Coml_KV));
+}
+
+COMLDEF Coml_Table* coml_new_table(const Coml_Allocator* allocator, const char* name) {
+    Coml_Table* table = (Coml_Table*)coml__alloc(allocator, sizeof(Coml_Table));
+    if (table == NULL) return NULL;
+
+    memset(table, 0, sizeof(Coml_Table));
+    table->name = coml__strdup(allocator, name);
+    if (table->name == NULL) {
+        coml__free(allocator, table, sizeof(Coml_Table));
+        return NULL;
+    }
+    
+    return table;
+}
+
+// The name must not be in the table yet
+static Coml_Table* coml__add_child(const Coml_Allocator* allocator, Coml_Table* table, const char* name, size_t length) {
+    Coml_Table* child = (Coml_Table*)coml__alloc(allocator, sizeof(Coml_Table));
+    if (child == NULL) return NULL;
+
+    memset(child, 0, sizeof(Coml_Table));
+    child->name = coml__strndup(allocator, name, length);
+    if (child->name == NULL || !coml__index_insert(allocator, &table->index, child->name, child, true)) {
+        coml_free_table(allocator, child);
+        return NULL;
+    }
+
+    coml__push_table(table, child);
+
+    return child;
+}
+
+COMLDEF Coml_Table* coml_insert_table(const Coml_Allocator* allocator, Coml_Table* table, const char* name) {
+    if (table == NULL || !coml__materialize(allocator, table)) return NULL;
+
+    Coml_Index_Slot* slot = coml__index_find(&table->index, name, strlen(name), coml__hash(name, strlen(name)));
+    if (slot != NULL) return slot->is_table ? (Coml_Table*)slot->node : NULL;
+
+    return coml__add_child(allocator, table, name, strlen(name));
+}
+
+static void coml__free_table_contents(const Coml_Allocator* allocator, Coml_Table* table) {
+    Coml_KV* current_kv = table->items;
+    while (current_kv != NULL) {
+        Coml_KV* temp_kv = current_kv;
+        current_kv = current_kv->next;
+        coml_free_kv(allocator, temp_kv);
+    }
+
+    Coml_Table* current_table = table->tables;
+    while (current_table != NULL) {
+        Coml_Table* temp_table = current_table;
+        current_table = current_table->next;
+        coml_free_table(allocator, temp_table);
+    }
+
+    for (size_t i = 0; i < table->array_length; ++i) {
+        coml__free_table_contents(allocator, &table->array[i]);
+    }
+    coml__free(allocator, table->array, sizeof(Coml_Table)*table->array_capacity);
+
+    coml__index_free(allocator, &table->index);
+    coml__free_string(allocator, table->name);
+}
+
+COMLDEF void coml_free_table(const Coml_Allocator* allocator, Coml_Table* table) {
+    if (table == NULL) return;
+
+    coml__free_table_contents(allocator, table);
+    coml__free(allocator, table, sizeof(Coml_Table));
+}
+
+COMLDEF Coml_Table* coml_append_table_array(const Coml_Allocator* allocator, Coml_Table* table, const char* name) {
+    if (table == NULL || !coml__materialize(allocator, table)) return NULL;
+
+    Coml_Index_Slot* slot = coml__index_find(&table->index, name, strlen(name), coml__hash(name, strlen(name)));
+    Coml_Table* array_table = NULL;
+    if (slot != NULL) {
+        if (!slot->is_table || !((Coml_Table*)slot->node)->is_array) return NULL;
+        array_table = (Coml_Table*)slot->node;
+    } else {
+        array_table = coml_insert_table(allocator, table, name);
+        if (array_table == NULL) return NULL;
+        array_table->is_array = true;
+        array_table->is_defined = true;
+    }
+
+    if (array_table->array_length == array_table->array_capacity) {
+        size_t new_capacity = array_table->array_capacity == 0 ? 4 : array_table->array_capacity*2;
+        Coml_Table* new_array = (Coml_Table*)coml__realloc(allocator, array_table->array, sizeof(Coml_Table)*array_table->array_capacity, sizeof(Coml_Table)*new_capacity);
+        if (new_array == NULL) return NULL;
+
+        array_table->array = new_array;
+        array_table->array_capacity = new_capacity;
+    }
+
+    Coml_Table* entry = &array_table->array[array_table->array_length++];
+    memset(entry, 0, sizeof(Coml_Table));
+
+    return entry;
+}
+
+COMLDEF size_t coml_table_array_len(const Coml_Table* table) {
+    if (table == NULL || !table->is_array) return 0;
+
+    return table->array_length;
+}
+
+COMLDEF const Coml_Table* coml_table_array_at(const Coml_Table* table, size_t index) {
+    if (table == NULL || !table->is_array || index >= table->array_length) return NULL;
+
+    return coml__body(&table->array[index]);
+}
+
+static bool coml__copy_value(const Coml_Allocator* allocator, const Coml_KV* kv, void** out) {
+    *out = NULL;
+    if (kv->value == NULL) return true;
+
+    switch (kv->type) {
+        case ComlType_Double:
+            *out = coml__alloc(allocator, sizeof(double));
+            if (*out != NULL) memcpy(*out, kv->value, sizeof(double));
+            break;
+        case ComlType_String:
+            *out = coml__strdup(allocator, (const char*)kv->value);
+            break;
+        case ComlType_Boolean:
+            *out = coml__alloc(allocator, sizeof(bool));
+            if (*out != NULL) memcpy(*out, kv->value, sizeof(bool));
+            break;
+        case ComlType_ListDouble:
+            if (kv->list_length == 0) return true;
+
+            *out = coml__alloc(allocator, sizeof(double)*kv->list_length);
+            if (*out != NULL) memcpy(*out, kv->value, sizeof(double)*kv->list_length);
+            break;
+        case ComlType_ListString: {
+            if (kv->list_length == 0) return true;
+
+            char** list = (char**)coml__alloc(allocator, sizeof(char*)*kv->list_length);
+            if (list == NULL) return false;
+
+            for (size_t i = 0; i < kv->list_length; ++i) {
+                list[i] = coml__strdup(allocator, ((char**)kv->value)[i]);
+                if (list[i] == NULL) {
+                    coml__free_value(allocator, kv->type, list, i);
+                    return false;
+                }
+            }
+            *out = list;
+        } break;
+    }
+
+    return *out != NULL;
+}
+
+static bool coml__value_equals(const Coml_KV* a, const Coml_KV* b) {
+    if (a->type != b->type || a->list_length != b->list_length) return false;
+
+    switch (a->type) {
+        case ComlType_Double:
+            return *(double*)a->value == *(double*)b->value;
+        case ComlType_String:
+            return strcmp((char*)a->value, (char*)b->value) == 0;
+        case ComlType_Boolean:
+            return *(bool*)a->value == *(bool*)b->value;
+        case ComlType_ListDouble:
+            for (size_t i = 0; i < a->list_length; ++i) {
+                if (((double*)a->value)[i] != ((double*)b->value)[i]) return false;
+            }
+            return true;
+        case ComlType_ListString:
+            for (size_t i = 0; i < a->list_length; ++i) {
+                if (strcmp(((char**)a->value)[i], ((char**)b->value)[i]) != 0) return false;
+            }
+            return true;
+    }
+
+    return false;
+}
+
+static Coml_KV* coml__copy_kv(const Coml_Allocator* allocator, const Coml_KV* kv) {
+    Coml_KV* copy = (Coml_KV*)coml__alloc(allocator, sizeof(Coml_KV));
+    if (copy == NULL) return NULL;
+
+    memset(copy, 0, sizeof(Coml_KV));
+    copy->key = coml__strdup(allocator, kv->key);
+    if (copy->key == NULL || !coml__copy_value(allocator, kv, &copy->value)) {
+        coml__free_string(allocator, copy->key);
+        coml__free(allocator, copy, sizeof(Coml_KV));
+        return NULL;
+    }
+    copy->type = kv->type;
+    copy->list_length = kv->list_length;
+
+    return copy;
+}
+
+// New table sharing the contents of table, arrays of tables get their own array of shared entries.
+// is_own is set when table is part of the document's own frozen tables, see Coml_Table.is_own_shared.
+static Coml_Table* coml__link_table(const Coml_Allocator* allocator, const Coml_Table* table, bool is_own) {
+    Coml_Table* link = coml_new_table(allocator, table->name);
+    if (link == NULL) return NULL;
+
+    if (!table->is_array) {
+        link->shared = coml__body(table);
+        link->is_own_shared = is_own && (table->shared == NULL || table->is_own_shared);
+        link->is_defined = link->shared->is_defined;
+        link->is_dotted = link->shared->is_dotted;
+        return link;
+    }
+
+    link->is_array = true;
+    link->is_defined = true;
+    if (table->array_length == 0) return link;
+
+    link->array = (Coml_Table*)coml__alloc(allocator, sizeof(Coml_Table)*table->array_length);
+    if (link->array == NULL) {
+        coml_free_table(allocator, link);
+        return NULL;
+    }
+    memset(link->array, 0, sizeof(Coml_Table)*table->array_length);
+
+    for (size_t i = 0; i < table->array_length; ++i) {
+        const Coml_Table* entry = &table->array[i];
+        link->array[i].shared = coml__body(entry);
+        link->array[i].is_own_shared = is_own && (entry->shared == NULL || entry->is_own_shared);
+    }
+    link->array_length = table->array_length;
+    link->array_capacity = table->array_length;
+
+    return link;
+}
+
+// Gives a shared table its own items, its child tables stay shared.
+// The document's own tables keep their spans, so the source still lines up with them.
+static bool coml__materialize(const Coml_Allocator* allocator, Coml_Table* table) {
+    if (table->shared == NULL) return true;
+
+    Coml_Table* body = coml__body(table);
+    bool is_own = table->is_own_shared;
+    Coml_Table copy;
+    memset(&copy, 0, sizeof(Coml_Table));
+
+    Coml_KV** kv_tail = &copy.items;
+    Coml_KV* last_kv = NULL;
+    for (Coml_KV* kv = body->items; kv != NULL; kv = kv->next) {
+        Coml_KV* new_kv = coml__copy_kv(allocator, kv);
+        if (new_kv == NULL || !coml__index_insert(allocator, &copy.index, new_kv->key, new_kv, false)) {
+            coml_free_kv(allocator, new_kv);
+            coml__free_table_contents(allocator, &copy);
+            return false;
+        }
+        if (is_own) {
+            new_kv->line = kv->line;
+            new_kv->span = kv->span;
+            new_kv->is_dirty = kv->is_dirty;
+        }
+
+        new_kv->prev = last_kv;
+        *kv_tail = new_kv;
+        kv_tail = &new_kv->next;
+        last_kv = new_kv;
+    }
+
+    Coml_Table** table_tail = &copy.tables;
+    Coml_Table* last_table = NULL;
+    for (Coml_Table* child = body->tables; child != NULL; child = child->next) {
+        Coml_Table* link = coml__link_table(allocator, child, is_own);
+        if (link == NULL || !coml__index_insert(allocator, &copy.index, link->name, link, true)) {
+            coml_free_table(allocator, link);
+            coml__free_table_contents(allocator, &copy);
+            return false;
+        }
+
+        link->prev = last_table;
+        *table_tail = link;
+        table_tail = &link->next;
+        last_table = link;
+    }
+
+    table->items = copy.items;
+    table->tables = copy.tables;
+    table->index = copy.index;
+    table->is_defined = body->is_defined;
+    table->is_dotted = body->is_dotted;
+    if (is_own) {
+        table->header = body->header;
+        table->source_end = body->source_end;
+    }
+    table->shared = NULL;
+    table->is_own_shared = false;
+
+    return true;
+}
+
+static void coml__add_removed(Coml* coml, Coml_Span span) {
+    if (span.end == 0) return;
+
+    if (coml->removed_length == coml->removed_capacity) {
+        size_t new_capacity = coml->removed_capacity == 0 ? 8 : coml->removed_capacity*2;
+        Coml_Span* new_removed = (Coml_Span*)coml__realloc(&coml->allocator, coml->removed, sizeof(Coml_Span)*coml->removed_capacity, sizeof(Coml_Span)*new_capacity);
+        // Without room the line is kept in the output, the document itself is still right
+        if (new_removed == NULL) return;
+
+        coml->removed = new_removed;
+        coml->removed_capacity = new_capacity;
+    }
+
+    coml->removed[coml->removed_length++] = span;
+}
+
+// Remembers the lines of a table that is about to be removed, tables shared from another document have none in this source
+static void coml__add_removed_table(Coml* coml, const Coml_Table* table) {
+    if (table->shared != NULL && !table->is_own_shared) return;
+    table = coml__body(table);
+
+    coml__add_removed(coml, table->header);
+    for (const Coml_KV* kv = table->items; kv != NULL; kv = kv->next) {
+        coml__add_removed(coml, kv->line);
+    }
+    for (const Coml_Table* child = table->tables; child != NULL; child = child->next) {
+        coml__add_removed_table(coml, child);
+    }
+    for (size_t i = 0; i < table->array_length; ++i) {
+        coml__add_removed_table(coml, &table->array[i]);
+    }
+}
+
+// Removes the KV or child table in slot from table and frees it
+static void coml__remove_node(Coml* coml, Coml_Table* table, Coml_Index_Slot* slot) {
+    const Coml_Allocator* allocator = &coml->allocator;
+    void* node = slot->node;
+    bool is_table = slot->is_table;
+    coml__index_remove(&table->index, slot);
+
+    if (coml->source != NULL) {
+        if (is_table) coml__add_removed_table(coml, (Coml_Table*)node);
+        else coml__add_removed(coml, ((Coml_KV*)node)->line);
+    }
+
+    if (is_table) {
+        Coml_Table* child = (Coml_Table*)node;
+        if (child->prev != NULL) child->prev->next = child->next;
+        else table->tables = child->next;
+        if (child->next != NULL) child->next->prev = child->prev;
+
+        coml_free_table(allocator, child);
+    } else {
+        Coml_KV* kv = (Coml_KV*)node;
+        if (kv->prev != NULL) kv->prev->next = kv->next;
+        else table->items = kv->next;
+        if (kv->next != NULL) kv->next->prev = kv->prev;
+
+        coml_free_kv(allocator, kv);
+    }
+}
+
+// True if merging src into dst would change dst, or fail with ComlMerge_Error
+static bool coml__merge_changes(const Coml_Table* dst, const Coml_Table* src, Coml_Merge_Policy policy) {
+    dst = coml__body(dst);
+    if (dst == src) return false;
+
+    for (const Coml_KV* kv = src->items; kv != NULL; kv = kv->next) {
+        Coml_Index_Slot* slot = coml__index_find(&dst->index, kv->key, strlen(kv->key), coml__hash(kv->key, strlen(kv->key)));
+        if (slot == NULL) return true;
+        if (policy == ComlMerge_Keep) continue;
+        if (slot->is_table || !coml__value_equals((const Coml_KV*)slot->node, kv)) return true;
+    }
+
+    for (const Coml_Table* child = src->tables; child != NULL; child = child->next) {
+        Coml_Index_Slot* slot = coml__index_find(&dst->index, child->name, strlen(child->name), coml__hash(child->name, strlen(child->name)));
+        if (slot == NULL) return true;
+
+        const Coml_Table* existing = slot->is_table ? (const Coml_Table*)slot->node : NULL;
+        if (existing != NULL && !existing->is_array && !child->is_array) {
+            if (coml__merge_changes(existing, coml__body(child), policy)) return true;
+            continue;
+        }
+        if (policy != ComlMerge_Keep) return true;
+    }
+
+    return false;
+}
+
+// New items and tables are collected in document order and put after the existing ones
+static bool coml__merge_table(Coml* coml, Coml_Table* dst, const Coml_Table* src, Coml_Merge_Policy policy) {
+    const Coml_Allocator* allocator = &coml->allocator;
+    if (coml__body(dst) == src) return true;
+    // A table that is still shared is only copied when src changes something in it
+    if (dst->shared != NULL && !coml__merge_changes(dst, src, policy)) return true;
+    if (!coml__materialize(allocator, dst)) return false;
+
+    bool res = true;
+    Coml_KV* new_items = NULL;
+    Coml_KV** kv_tail = &new_items;
+    Coml_KV* last_kv = NULL;
+    for (const Coml_KV* kv = src->items; res && kv != NULL; kv = kv->next) {
+        Coml_Index_Slot* slot = coml__index_find(&dst->index, kv->key, strlen(kv->key), coml__hash(kv->key, strlen(kv->key)));
+        if (slot != NULL) {
+            if (policy == ComlMerge_Keep) continue;
+
+            if (!slot->is_table) {
+                Coml_KV* existing = (Coml_KV*)slot->node;
+                if (coml__value_equals(existing, kv)) continue;
+                if (policy == ComlMerge_Error) {
+                    res = false;
+                    continue;
+                }
+
+                void* value = NULL;
+                res = coml__copy_value(allocator, kv, &value);
+                if (!res) continue;
+
+                coml__free_value(allocator, existing->type, existing->value, existing->list_length);
+                existing->value = value;
+                existing->type = kv->type;
+                existing->list_length = kv->list_length;
+                existing->is_dirty = true;
+                continue;
+            }
+
+            if (policy == ComlMerge_Error) {
+                res = false;
+                continue;
+            }
+            coml__remove_node(coml, dst, slot);
+        }
+
+        Coml_KV* new_kv = coml__copy_kv(allocator, kv);
+        res = new_kv != NULL && coml__index_insert(allocator, &dst->index, new_kv->key, new_kv, false);
+        if (!res) {
+            coml_free_kv(allocator, new_kv);
+            continue;
+        }
+
+        new_kv->prev = last_kv;
+        *kv_tail = new_kv;
+        kv_tail = &new_kv->next;
+        last_kv = new_kv;
+    }
+    *kv_tail = dst->items;
+    if (dst->items != NULL) dst->items->prev = last_kv;
+    dst->items = new_items;
+
+    Coml_Table* new_tables = NULL;
+    Coml_Table** table_tail = &new_tables;
+    Coml_Table* last_table = NULL;
+    for (const Coml_Table* child = src->tables; res && child != NULL; child = child->next) {
+        Coml_Index_Slot* slot = coml__index_find(&dst->index, child->name, strlen(child->name), coml__hash(child->name, strlen(child->name)));
+        if (slot != NULL) {
+            Coml_Table* existing = slot->is_table ? (Coml_Table*)slot->node : NULL;
+            if (existing != NULL && !existing->is_array && !child->is_array) {
+                res = coml__merge_table(coml, existing, coml__body(child), policy);
+                continue;
+            }
+
+            // Arrays of tables are replaced as a whole
+            if (policy == ComlMerge_Keep) continue;
+            if (policy == ComlMerge_Error) {
+                res = false;
+                continue;
+            }
+            coml__remove_node(coml, dst, slot);
+        }
+
+        Coml_Table* link = coml__link_table(allocator, child, false);
+        res = link != NULL && coml__index_insert(allocator, &dst->index, link->name, link, true);
+        if (!res) {
+            coml_free_table(allocator, link);
+            continue;
+        }
+
+        link->prev = last_table;
+        *table_tail = link;
+        table_tail = &link->next;
+        last_table = link;
+    }
+    *table_tail = dst->tables;
+    if (dst->tables != NULL) dst->tables->prev = last_table;
+    dst->tables = new_tables;
+
+    return res;
+}
+
+static bool coml__add_source(Coml* coml, Coml* source) {
+    for (size_t i = 0; i < coml->sources_length; ++i) {
+        if (coml->sources[i] == source) return true;
+    }
+
+    if (coml->sources_length == coml->sources_capacity) {
+        size_t new_capacity = coml->sources_capacity == 0 ? 4 : coml->sources_capacity*2;
+        Coml** new_sources = (Coml**)coml__realloc(&coml->allocator, coml->sources, sizeof(Coml*)*coml->sources_capacity, sizeof(Coml*)*new_capacity);
+        if (new_sources == NULL) return false;
+
+        coml->sources = new_sources;
+        coml->sources_capacity = new_capacity;
+    }
+
+    coml->sources[coml->sources_length++] = source;
+    source->refs += 1;
+
+    return true;
+}
+
+// Moves the tables of coml into a new document that is never changed again, so they can be
+// shared, coml keeps a root table that shares them
+static Coml* coml__freeze(Coml* coml) {
+    for (size_t i = 0; coml->root->shared != NULL && i < coml->sources_length; ++i) {
+        if (coml->sources[i]->root == coml->root->shared) return coml->sources[i];
+    }
+
+    Coml* frozen = (Coml*)coml__alloc(&coml->allocator, sizeof(Coml));
+    if (frozen == NULL) return NULL;
+
+    Coml_Table* root = coml_new_table(&coml->allocator, "");
+    if (root == NULL) {
+        coml__free(&coml->allocator, frozen, sizeof(Coml));
+        return NULL;
+    }
+
+    // The source stays with coml, the spans of the moved tables still point into it
+    *frozen = *coml;
+    frozen->refs = 0;
+    frozen->source = NULL;
+    frozen->source_length = 0;
+    frozen->removed = NULL;
+    frozen->removed_length = 0;
+    frozen->removed_capacity = 0;
+    root->shared = coml->root;
+    root->is_own_shared = true;
+    coml->root = root;
+    coml->sources = NULL;
+    coml->sources_length = 0;
+    coml->sources_capacity = 0;
+
+    if (!coml__add_source(coml, frozen)) {
+        coml_free_table(&coml->allocator, root);
+        coml->root = frozen->root;
+        coml->sources = frozen->sources;
+        coml->sources_length = frozen->sources_length;
+        coml->sources_capacity = frozen->sources_capacity;
+        coml__free(&coml->allocator, frozen, sizeof(Coml));
+        return NULL;
+    }
+
+    return frozen;
+}
+
+COMLDEF Coml* coml_clone(Coml* coml) {
+    if (coml == NULL) return NULL;
+
+    Coml* frozen = coml__freeze(coml);
+    if (frozen == NULL) return NULL;
+
+    Coml* clone = (Coml*)coml__alloc(&coml->allocator, sizeof(Coml));
+    if (clone == NULL) return NULL;
+
+    memset(clone, 0, sizeof(Coml));
+    clone->allocator = coml->allocator;
+    clone->refs = 1;
+    clone->root = coml_new_table(&clone->allocator, "");
+    if (clone->root == NULL || !coml__add_source(clone, frozen)) {
+        coml_free(clone);
+        return NULL;
+    }
+    clone->root->shared = frozen->root;
+
+    return clone;
+}
+
+COMLDEF bool coml_merge(Coml* dst, Coml* src, Coml_Merge_Policy policy) {
+    if (dst == NULL || src == NULL) return false;
+    if (dst == src) return true;
+
+    Coml* frozen = coml__freeze(src);
+    if (frozen == NULL || !coml__add_source(dst, frozen)) return false;
+
+    return coml__merge_table(dst, dst->root, coml__body(frozen->root), policy);
+}
+
+// Walks a dotted path from table, the last segment can name a KV or a table
+static Coml_Index_Slot* coml__lookup(Coml_Table* table, const char* path) {
+    size_t end = strlen(path);
+    size_t pos = 0;
+    Coml_Index_Slot* slot = NULL;
+
+    while (pos < end) {
+        if (slot != NULL) {
+            if (!slot->is_table) return NULL;
+            table = (Coml_Table*)slot->node;
+        }
+
+        size_t segment_start = 0;
+        size_t segment_length = 0;
+        if (!coml__next_key_segment(path, &pos, end, &segment_start, &segment_length)) return NULL;
+
+        slot = coml__index_find(&coml__body(table)->index, path+segment_start, segment_length, coml__hash(path+segment_start, segment_length));
+        if (slot == NULL) return NULL;
+    }
+
+    return slot;
+}
+
+COMLDEF const Coml_Table* coml_get_table(Coml* coml, const char* path) {
+    if (coml == NULL) return NULL;
+    if (path == NULL || path[0] == '\0') return coml__body(coml->root);
+
+    Coml_Index_Slot* slot = coml__lookup(coml->root, path);
+    if (slot == NULL || !slot->is_table) return NULL;
+
+    return coml__body((Coml_Table*)slot->node);
+}
+
+COMLDEF const Coml_KV* coml_get_path(Coml* coml, const char* path) {
+    if (coml == NULL || path == NULL) return NULL;
+
+    Coml_Index_Slot* slot = coml__lookup(coml->root, path);
+    if (slot == NULL || slot->is_table) return NULL;
+
+    return (Coml_KV*)slot->node;
+}
+
+// Depth-first search for a key in table and all of its child tables
+static Coml_KV* coml__find_kv(Coml_Table* table, const char* key, size_t length, size_t hash) {
+    table = coml__body(table);
+    Coml_Index_Slot* slot = coml__index_find(&table->index, key, length, hash);
+    if (slot != NULL && !slot->is_table) return (Coml_KV*)slot->node;
+
+    for (Coml_Table* child = table->tables; child != NULL; child = child->next) {
+        Coml_KV* kv = coml__find_kv(child, key, length, hash);
+        if (kv != NULL) return kv;
+    }
+
+    for (size_t i = 0; i < table->array_length; ++i) {
+        Coml_KV* kv = coml__find_kv(&table->array[i], key, length, hash);
+        if (kv != NULL) return kv;
+    }
+
+    return NULL;
+}
+
+// Lookup behind the getters, the KV can belong to a shared document
+static const Coml_KV* coml__get_kv(Coml* coml, const char* table_name, const char* key_name) {
+    if (coml == NULL || key_name == NULL) return NULL;
+
+    if (table_name == NULL) {
+        size_t length = strlen(key_name);
+        return coml__find_kv(coml->root, key_name, length, coml__hash(key_name, length));
+    }
+
+    const Coml_Table* table = coml_get_table(coml, table_name);
+    if (table == NULL) return NULL;
+
+    Coml_Index_Slot* slot = coml__lookup((Coml_Table*)table, key_name);
+    if (slot == NULL || slot->is_table) return NULL;
+
+    return (const Coml_KV*)slot->node;
+}
+
+COMLDEF void* coml_get_value_raw(Coml* coml, Coml_Type type, const char* table_name, const char* key_name) {
+    const Coml_KV* kv = coml__get_kv(coml, table_name == NULL ? "" : table_name, key_name);
+    if (kv == NULL || kv->type != type) return NULL;
+
+    return kv->value;
+}
+
+COMLDEF int coml_get_value_int(Coml* coml, const char* table_name, const char* key_name) {
+    void* value = coml_get_value_raw(coml, ComlType_Double, table_name, key_name);
+    if (value == NULL) return 0;
+
+    return (int)*(double*)value;
+}
+
+COMLDEF float coml_get_value_float(Coml* coml, const char* table_name, const char* key_name) {
     void* value = coml_get_value_raw(coml, ComlType_Double, table_name, key_name);
     if (value == NULL) return 0.f;
 
-    return (float)*(double*)value;
+    return (float)*(double*)value;
+}
+
+COMLDEF char* coml_get_value_string(Coml* coml, const char* table_name, const char* key_name) {
+    void* value = coml_get_value_raw(coml, ComlType_String, table_name, key_name);
+    if (value == NULL) return NULL;
+
+    return (char*)value;
+}
+
+COMLDEF bool coml_get_value_bool(Coml* coml, const char* table_name, const char* key_name) {
+    void* value = coml_get_value_raw(coml, ComlType_Boolean, table_name, key_name);
+    if (value == NULL) return false;
+
+    return *(bool*)value;
+}
+
+COMLDEF double* coml_get_value_list_double(Coml* coml, const char* table_name, const char* key_name) {
+    void* value = coml_get_value_raw(coml, ComlType_ListDouble, table_name, key_name);
+    if (value == NULL) return NULL;
+
+    return (double*)value;
+}
+
+COMLDEF char** coml_get_value_list_string(Coml* coml, const char* table_name, const char* key_name) {
+    void* value = coml_get_value_raw(coml, ComlType_ListString, table_name, key_name);
+    if (value == NULL) return NULL;
+
+    return (char**)value;
+}
+
+COMLDEF void* coml_find_value_raw(Coml* coml, Coml_Type type, const char* key_name) {
+    const Coml_KV* kv = coml__get_kv(coml, NULL, key_name);
+    if (kv == NULL || kv->type != type) return NULL;
+
+    return kv->value;
+}
+
+COMLDEF int coml_find_value_int(Coml* coml, const char* key_name) {
+    void* value = coml_find_value_raw(coml, ComlType_Double, key_name);
+    if (value == NULL) return 0;
+
+    return (int)*(double*)value;
+}
+
+COMLDEF float coml_find_value_float(Coml* coml, const char* key_name) {
+    void* value = coml_find_value_raw(coml, ComlType_Double, key_name);
+    if (value == NULL) return 0.f;
+
+    return (float)*(double*)value;
+}
+
+COMLDEF char* coml_find_value_string(Coml* coml, const char* key_name) {
+    void* value = coml_find_value_raw(coml, ComlType_String, key_name);
+    if (value == NULL) return NULL;
+
+    return (char*)value;
+}
+
+COMLDEF bool coml_find_value_bool(Coml* coml, const char* key_name) {
+    void* value = coml_find_value_raw(coml, ComlType_Boolean, key_name);
+    if (value == NULL) return false;
+
+    return *(bool*)value;
+}
+
+COMLDEF double* coml_find_value_list_double(Coml* coml, const char* key_name) {
+    void* value = coml_find_value_raw(coml, ComlType_ListDouble, key_name);
+    if (value == NULL) return NULL;
+
+    return (double*)value;
+}
+
+COMLDEF char** coml_find_value_list_string(Coml* coml, const char* key_name) {
+    void* value = coml_find_value_raw(coml, ComlType_ListString, key_name);
+    if (value == NULL) return NULL;
+
+    return (char**)value;
+}
+
+#define COML__QUERY_MAX_SEGMENTS 63 // States 0 to segments_length are bits of an unsigned long long
+
+typedef enum {
+    ComlQuery_Name,
+    ComlQuery_Glob,
+    ComlQuery_AnyDepth, // "**", matches tables only
+} Coml__Query_Kind;
+
+typedef struct Coml__Query_Segment {
+    const char* text;
+    size_t length;
+    Coml__Query_Kind kind;
+} Coml__Query_Segment;
+
+typedef enum {
+    ComlQueryPhase_Keys,
+    ComlQueryPhase_Tables,
+    ComlQueryPhase_Entries, // Of an array of tables
+} Coml__Query_Phase;
+
+// A table being walked, states has bit i set when segment i is the next one to match
+typedef struct Coml__Query_Frame {
+    Coml_Table* table; // The body, or the array of tables for ComlQueryPhase_Entries
+    unsigned long long states;
+    Coml__Query_Phase phase;
+    bool is_started;
+    Coml_KV* kv; // Next key in document order
+    Coml_Table* child; // Next child table in document order
+    size_t entry;
+} Coml__Query_Frame;
+
+#define COML__QUERY_BIT(i) (1ULL << (i))
+
+// '*' matches any run of characters
+static bool coml__glob(const char* glob, size_t glob_length, const char* name, size_t length) {
+    size_t g = 0;
+    size_t n = 0;
+    size_t star = glob_length;
+    size_t star_n = 0;
+
+    while (n < length) {
+        if (g < glob_length && glob[g] == '*') {
+            star = g++;
+            star_n = n;
+        } else if (g < glob_length && glob[g] == name[n]) {
+            ++g;
+            ++n;
+        } else if (star < glob_length) {
+            g = star+1;
+            n = ++star_n;
+        } else {
+            return false;
+        }
+    }
+
+    while (g < glob_length && glob[g] == '*') ++g;
+    return g == glob_length;
+}
+
+static bool coml__query_segment_matches(const Coml__Query_Segment* segment, const char* name, size_t length) {
+    switch (segment->kind) {
+        case ComlQuery_Name: return segment->length == length && memcmp(segment->text, name, length) == 0;
+        case ComlQuery_Glob: return coml__glob(segment->text, segment->length, name, length);
+        case ComlQuery_AnyDepth: return false;
+    }
+
+    return false;
+}
+
+// "**" can match no tables at all, so it also enables the segment after it
+static unsigned long long coml__query_close(const Coml_Query* query, unsigned long long states) {
+    for (size_t i = 0; i < query->segments_length; ++i) {
+        if ((states & COML__QUERY_BIT(i)) && query->segments[i].kind == ComlQuery_AnyDepth) states |= COML__QUERY_BIT(i+1);
+    }
+
+    return states;
+}
+
+// States of a child table named name
+static unsigned long long coml__query_step(const Coml_Query* query, unsigned long long states, const char* name, size_t length) {
+    unsigned long long next = 0;
+    for (size_t i = 0; i < query->segments_length; ++i) {
+        if (!(states & COML__QUERY_BIT(i))) continue;
+
+        const Coml__Query_Segment* segment = &query->segments[i];
+        if (segment->kind == ComlQuery_AnyDepth) next |= COML__QUERY_BIT(i);
+        else if (coml__query_segment_matches(segment, name, length)) next |= COML__QUERY_BIT(i+1);
+    }
+
+    return coml__query_close(query, next);
+}
+
+// The name to look up in the index when a single plain name is all that can match below the table
+static const Coml__Query_Segment* coml__query_single_name(const Coml_Query* query, unsigned long long states) {
+    const Coml__Query_Segment* found = NULL;
+    for (size_t i = 0; i < query->segments_length; ++i) {
+        if (!(states & COML__QUERY_BIT(i))) continue;
+        if (found != NULL || query->segments[i].kind != ComlQuery_Name) return NULL;
+        found = &query->segments[i];
+    }
+
+    return found;
+}
+
+static bool coml__query_push(Coml_Query* query, Coml_Table* table, unsigned long long states, Coml__Query_Phase phase) {
+    if (query->frames_length == query->frames_capacity) {
+        size_t new_capacity = query->frames_capacity == 0 ? 8 : query->frames_capacity*2;
+        Coml__Query_Frame* new_frames = (Coml__Query_Frame*)coml__realloc(&query->allocator, query->frames, sizeof(Coml__Query_Frame)*query->frames_capacity, sizeof(Coml__Query_Frame)*new_capacity);
+        if (new_frames == NULL) return false;
+
+        query->frames = new_frames;
+        query->frames_capacity = new_capacity;
+    }
+
+    Coml__Query_Frame* frame = &query->frames[query->frames_length++];
+    memset(frame, 0, sizeof(Coml__Query_Frame));
+    frame->table = table;
+    frame->states = states;
+    frame->phase = phase;
+
+    return true;
+}
+
+// Walks into a child table and sets is_match if the child itself matches, returns false if out of memory
+static bool coml__query_enter(Coml_Query* query, Coml_Table* child, unsigned long long states, bool* is_match) {
+    *is_match = false;
+    if (states == 0) return true;
+
+    if (child->is_array) return coml__query_push(query, child, states, ComlQueryPhase_Entries);
+
+    if (!coml__query_push(query, coml__body(child), states, ComlQueryPhase_Keys)) return false;
+    if (states & COML__QUERY_BIT(query->segments_length)) {
+        query->table = coml__body(child);
+        *is_match = true;
+    }
+
+    return true;
+}
+
+COMLDEF bool coml_query(Coml* coml, const char* pattern, Coml_Query* query) {
+    if (query == NULL) return false;
+    memset(query, 0, sizeof(Coml_Query));
+    if (coml == NULL || pattern == NULL || pattern[0] == '\0') return false;
+
+    query->allocator = coml->allocator;
+    size_t end = strlen(pattern);
+    query->pattern = coml__strndup(&query->allocator, pattern, end);
+    query->segments = (Coml__Query_Segment*)coml__alloc(&query->allocator, sizeof(Coml__Query_Segment)*COML__QUERY_MAX_SEGMENTS);
+    if (query->pattern == NULL || query->segments == NULL) {
+        coml_query_free(query);
+        return false;
+    }
+
+    // Like coml__next_key_segment, with '*' allowed in bare segments
+    const char* input = query->pattern;
+    size_t pos = 0;
+    while (pos < end) {
+        if (query->segments_length == COML__QUERY_MAX_SEGMENTS) {
+            coml_query_free(query);
+            return false;
+        }
+
+        while (pos < end && coml__is_space(input[pos])) ++pos;
+
+        Coml__Query_Segment* segment = &query->segments[query->segments_length++];
+        bool is_quoted = pos < end && (input[pos] == '"' || input[pos] == '\'');
+        if (is_quoted) {
+            const char* close = (const char*)memchr(input+pos+1, input[pos], end-pos-1);
+            if (close == NULL) {
+                coml_query_free(query);
+                return false;
+            }
+
+            segment->text = input+pos+1;
+            segment->length = (size_t)(close-input)-pos-1;
+            segment->kind = ComlQuery_Name;
+            pos = (size_t)(close-input)+1;
+        } else {
+            size_t start = pos;
+            bool is_glob = false;
+            while (pos < end && (coml__is_bare_key_char(input[pos]) || input[pos] == '*')) {
+                if (input[pos] == '*') is_glob = true;
+                ++pos;
+            }
+
+            segment->text = input+start;
+            segment->length = pos-start;
+            segment->kind = is_glob ? ComlQuery_Glob : ComlQuery_Name;
+            if (segment->length == 2 && memcmp(segment->text, "**", 2) == 0) segment->kind = ComlQuery_AnyDepth;
+        }
+
+        while (pos < end && coml__is_space(input[pos])) ++pos;
+        if (pos < end && input[pos] != '.') {
+            coml_query_free(query);
+            return false;
+        }
+        if (pos < end && ++pos == end) {
+            coml_query_free(query);
+            return false;
+        }
+        if (segment->length == 0 && !is_quoted) {
+            coml_query_free(query);
+            return false;
+        }
+    }
+
+    unsigned long long states = coml__query_close(query, COML__QUERY_BIT(0));
+    if (!coml__query_push(query, coml__body(coml->root), states, ComlQueryPhase_Keys)) {
+        coml_query_free(query);
+        return false;
+    }
+
+    return true;
+}
+
+COMLDEF bool coml_query_next(Coml_Query* query) {
+    if (query == NULL) return false;
+
+    query->table = NULL;
+    query->kv = NULL;
+    size_t last = query->segments_length-1;
+
+    while (query->frames_length > 0) {
+        Coml__Query_Frame* frame = &query->frames[query->frames_length-1];
+        Coml_Table* table = frame->table;
+
+        if (frame->phase == ComlQueryPhase_Keys) {
+            const Coml__Query_Segment* segment = &query->segments[last];
+            if (!(frame->states & COML__QUERY_BIT(last)) || segment->kind == ComlQuery_AnyDepth) {
+                frame->phase = ComlQueryPhase_Tables;
+                continue;
+            }
+
+            // A plain name is found through the index, globs go through the keys
+            if (segment->kind == ComlQuery_Name) {
+                frame->phase = ComlQueryPhase_Tables;
+                Coml_Index_Slot* slot = coml__index_find(&table->index, segment->text, segment->length, coml__hash(segment->text, segment->length));
+                if (slot == NULL || slot->is_table) continue;
+
+                query->kv = (Coml_KV*)slot->node;
+                return true;
+            }
+
+            // The oldest key is the last one in the list
+            if (!frame->is_started) {
+                frame->is_started = true;
+                frame->kv = table->items;
+                while (frame->kv != NULL && frame->kv->next != NULL) frame->kv = frame->kv->next;
+            }
+
+            while (frame->kv != NULL) {
+                Coml_KV* kv = frame->kv;
+                frame->kv = kv->prev;
+                if (coml__glob(segment->text, segment->length, kv->key, strlen(kv->key))) {
+                    query->kv = kv;
+                    return true;
+                }
+            }
+
+            frame->phase = ComlQueryPhase_Tables;
+            frame->is_started = false;
+            continue;
+        }
+
+        if (frame->phase == ComlQueryPhase_Entries) {
+            if (frame->entry == table->array_length) {
+                --query->frames_length;
+                continue;
+            }
+
+            Coml_Table* entry = &table->array[frame->entry++];
+            unsigned long long states = frame->states;
+            if (!coml__query_push(query, coml__body(entry), states, ComlQueryPhase_Keys)) return false;
+            if (!(states & COML__QUERY_BIT(query->segments_length))) continue;
+
+            query->table = coml__body(entry);
+            return true;
+        }
+
+        unsigned long long states = frame->states & ~COML__QUERY_BIT(query->segments_length);
+        if (states == 0) {
+            --query->frames_length;
+            continue;
+        }
+
+        const Coml__Query_Segment* name = coml__query_single_name(query, states);
+        if (name != NULL) {
+            --query->frames_length;
+            Coml_Index_Slot* slot = coml__index_find(&table->index, name->text, name->length, coml__hash(name->text, name->length));
+            if (slot == NULL || !slot->is_table) continue;
+
+            bool is_match = false;
+            if (!coml__query_enter(query, (Coml_Table*)slot->node, coml__query_step(query, states, name->text, name->length), &is_match)) return false;
+            if (is_match) return true;
+            continue;
+        }
+
+        if (!frame->is_started) {
+            frame->is_started = true;
+            frame->child = table->tables;
+            while (frame->child != NULL && frame->child->next != NULL) frame->child = frame->child->next;
+        }
+
+        if (frame->child == NULL) {
+            --query->frames_length;
+            continue;
+        }
+
+        Coml_Table* child = frame->child;
+        frame->child = child->prev;
+
+        bool is_match = false;
+        if (!coml__query_enter(query, child, coml__query_step(query, states, child->name, strlen(child->name)), &is_match)) return false;
+        if (is_match) return true;
+    }
+
+    return false;
+}
+
+COMLDEF void coml_query_free(Coml_Query* query) {
+    if (query == NULL) return;
+
+    coml__free(&query->allocator, query->frames, sizeof(Coml__Query_Frame)*query->frames_capacity);
+    coml__free(&query->allocator, query->segments, sizeof(Coml__Query_Segment)*COML__QUERY_MAX_SEGMENTS);
+    coml__free_string(&query->allocator, query->pattern);
+    memset(query, 0, sizeof(Coml_Query));
+}
+
+// Like coml__lookup, but gives every shared table on the way its own items
+static Coml_Index_Slot* coml__lookup_edit(const Coml_Allocator* allocator, Coml_Table* table, const char* path) {
+    size_t end = strlen(path);
+    size_t pos = 0;
+    Coml_Index_Slot* slot = NULL;
+
+    while (pos < end) {
+        if (slot != NULL) {
+            if (!slot->is_table) return NULL;
+            table = (Coml_Table*)slot->node;
+        }
+        if (!coml__materialize(allocator, table)) return NULL;
+
+        size_t segment_start = 0;
+        size_t segment_length = 0;
+        if (!coml__next_key_segment(path, &pos, end, &segment_start, &segment_length)) return NULL;
+
+        slot = coml__index_find(&table->index, path+segment_start, segment_length, coml__hash(path+segment_start, segment_length));
+        if (slot == NULL) return NULL;
+    }
+
+    return slot;
+}
+
+// Like coml__find_kv, but only the tables on the way to the found key get their own items
+static Coml_KV* coml__find_kv_edit(const Coml_Allocator* allocator, Coml_Table* table, const char* key, size_t length, size_t hash) {
+    Coml_Table* body = coml__body(table);
+
+    Coml_Index_Slot* slot = coml__index_find(&body->index, key, length, hash);
+    if (slot != NULL && !slot->is_table) {
+        if (!coml__materialize(allocator, table)) return NULL;
+        return (Coml_KV*)coml__index_find(&table->index, key, length, hash)->node;
+    }
+
+    for (Coml_Table* child = body->tables; child != NULL; child = child->next) {
+        if (coml__find_kv(child, key, length, hash) == NULL) continue;
+        if (!coml__materialize(allocator, table)) return NULL;
+
+        Coml_Index_Slot* child_slot = coml__index_find(&table->index, child->name, strlen(child->name), coml__hash(child->name, strlen(child->name)));
+        return coml__find_kv_edit(allocator, (Coml_Table*)child_slot->node, key, length, hash);
+    }
+
+    for (size_t i = 0; i < table->array_length; ++i) {
+        if (coml__find_kv(&table->array[i], key, length, hash) != NULL) return coml__find_kv_edit(allocator, &table->array[i], key, length, hash);
+    }
+
+    return NULL;
+}
+
+// Same lookup as coml_get_kv, for changing the value
+static Coml_KV* coml__edit_kv(Coml* coml, const char* table_name, const char* key_name) {
+    if (coml == NULL || key_name == NULL) return NULL;
+
+    if (table_name == NULL) {
+        size_t length = strlen(key_name);
+        return coml__find_kv_edit(&coml->allocator, coml->root, key_name, length, coml__hash(key_name, length));
+    }
+
+    Coml_Table* table = coml->root;
+    if (table_name[0] != '\0') {
+        Coml_Index_Slot* slot = coml__lookup_edit(&coml->allocator, table, table_name);
+        if (slot == NULL || !slot->is_table) return NULL;
+        table = (Coml_Table*)slot->node;
+    }
+
+    Coml_Index_Slot* slot = coml__lookup_edit(&coml->allocator, table, key_name);
+    if (slot == NULL || slot->is_table) return NULL;
+
+    return (Coml_KV*)slot->node;
+}
+
+COMLDEF Coml_KV* coml_get_kv(Coml* coml, const char* table_name, const char* key_name) {
+    return coml__edit_kv(coml, table_name, key_name);
+}
+
+COMLDEF bool coml_set_int(Coml* coml, int value, const char* table_name, const char* key_name) {
+    Coml_KV* kv = coml__edit_kv(coml, table_name, key_name);
+    if (kv == NULL || kv->type != ComlType_Double) return false;
+
+    *((double*)kv->value) = (double)value;
+    kv->is_dirty = true;
+
+    return true;
+}
+
+COMLDEF bool coml_set_float(Coml* coml, float value, const char* table_name, const char* key_name) {
+    Coml_KV* kv = coml__edit_kv(coml, table_name, key_name);
+    if (kv == NULL || kv->type != ComlType_Double) return false;
+
+    *((double*)kv->value) = (double)value;
+    kv->is_dirty = true;
+
+    return true;
+}
+
+COMLDEF bool coml_set_string(Coml* coml, char* value, const char* table_name, const char* key_name) {
+    Coml_KV* kv = coml__edit_kv(coml, table_name, key_name);
+    if (kv == NULL || kv->type != ComlType_String) return false;
+
+    char* new_value = coml__strdup(&coml->allocator, value);
+    if (new_value == NULL) return false;
+
+    coml__free_string(&coml->allocator, (char*)kv->value);
+    kv->value = new_value;
+    kv->is_dirty = true;
+
+    return true;
+}
+
+COMLDEF bool coml_set_bool(Coml* coml, bool value, const char* table_name, const char* key_name) {
+    Coml_KV* kv = coml__edit_kv(coml, table_name, key_name);
+    if (kv == NULL || kv->type != ComlType_Boolean) return false;
+
+    *((bool*)kv->value) = value;
+    kv->is_dirty = true;
+
+    return true;
+}
+
+COMLDEF bool coml_set_list_double(Coml* coml, double* value, size_t length, const char* table_name, const char* key_name) {
+    Coml_KV* kv = coml__edit_kv(coml, table_name, key_name);
+    if (kv == NULL || kv->type != ComlType_ListDouble) return false;
+
+    void* new_value = coml__realloc(&coml->allocator, kv->value, sizeof(double)*kv->list_length, sizeof(double)*length);
+    if (new_value == NULL && length != 0) return false;
+
+    kv->value = new_value;
+    for (size_t i = 0; i < length; i++) {
+        ((double*)kv->value)[i] = value[i];
+    }
+    kv->list_length = length;
+    kv->is_dirty = true;
+
+    return true;
+}
+
+COMLDEF bool coml_set_list_string(Coml* coml, char** value, size_t length, const char* table_name, const char* key_name) {
+    Coml_KV* kv = coml__edit_kv(coml, table_name, key_name);
+    if (kv == NULL || kv->type != ComlType_ListString) return false;
+
+    char** new_value = (char**)coml__alloc(&coml->allocator, sizeof(char*)*length);
+    if (new_value == NULL && length != 0) return false;
+
+    for (size_t i = 0; i < length; i++) {
+        new_value[i] = coml__strdup(&coml->allocator, value[i]);
+        if (new_value[i] == NULL) {
+            while (i-- > 0) coml__free_string(&coml->allocator, new_value[i]);
+            coml__free(&coml->allocator, new_value, sizeof(char*)*length);
+            return false;
+        }
+    }
+
+    coml__free_value(&coml->allocator, kv->type, kv->value, kv->list_length);
+    kv->value = new_value;
+    kv->list_length = length;
+    kv->is_dirty = true;
+
+    return true;
+}
+
+// Walks all but the last segment of path, which is returned in last_start and last_length
+static Coml_Table* coml__edit_parent(Coml* coml, const char* path, bool create, size_t* last_start, size_t* last_length) {
+    size_t end = strlen(path);
+    size_t pos = 0;
+    if (!coml__next_key_segment(path, &pos, end, last_start, last_length)) return NULL;
+
+    Coml_Table* table = coml->root;
+    while (true) {
+        if (!coml__materialize(&coml->allocator, table)) return NULL;
+        if (pos == end) return table;
+
+        Coml_Index_Slot* slot = coml__index_find(&table->index, path+*last_start, *last_length, coml__hash(path+*last_start, *last_length));
+        if (slot != NULL) {
+            if (!slot->is_table || ((Coml_Table*)slot->node)->is_array) return NULL;
+            table = (Coml_Table*)slot->node;
+        } else {
+            if (!create) return NULL;
+            table = coml__add_child(&coml->allocator, table, path+*last_start, *last_length);
+            if (table == NULL) return NULL;
+        }
+
+        if (!coml__next_key_segment(path, &pos, end, last_start, last_length)) return NULL;
+    }
+}
+
+static Coml_Table* coml__edit_table(Coml* coml, const char* path, bool create) {
+    Coml_Table* table = coml->root;
+    if (path != NULL && path[0] != '\0') {
+        size_t start = 0;
+        size_t length = 0;
+        Coml_Table* parent = coml__edit_parent(coml, path, create, &start, &length);
+        if (parent == NULL) return NULL;
+
+        Coml_Index_Slot* slot = coml__index_find(&parent->index, path+start, length, coml__hash(path+start, length));
+        if (slot != NULL) {
+            if (!slot->is_table || ((Coml_Table*)slot->node)->is_array) return NULL;
+            table = (Coml_Table*)slot->node;
+        } else {
+            if (!create) return NULL;
+            table = coml__add_child(&coml->allocator, parent, path+start, length);
+            if (table == NULL) return NULL;
+        }
+    }
+
+    if (!coml__materialize(&coml->allocator, table)) return NULL;
+
+    return table;
+}
+
+// Takes ownership of value, it is freed if adding fails
+static bool coml__add_value(Coml* coml, const char* table_name, const char* key_name, Coml_Type type, void* value, size_t list_length) {
+    Coml_Table* table = coml__edit_table(coml, table_name, true);
+    Coml_Index_Slot* slot = table == NULL ? NULL : coml__index_find(&table->index, key_name, strlen(key_name), coml__hash(key_name, strlen(key_name)));
+    if (table == NULL || (slot != NULL && slot->is_table)) {
+        coml__free_value(&coml->allocator, type, value, list_length);
+        return false;
+    }
+
+    if (slot != NULL) {
+        Coml_KV* kv = (Coml_KV*)slot->node;
+        coml__free_value(&coml->allocator, kv->type, kv->value, kv->list_length);
+        kv->type = type;
+        kv->value = value;
+        kv->list_length = list_length;
+        kv->is_dirty = true;
+        return true;
+    }
+
+    Coml_KV kv;
+    memset(&kv, 0, sizeof(Coml_KV));
+    kv.type = type;
+    kv.value = value;
+    kv.list_length = list_length;
+
+    return coml__attach_kv(&coml->allocator, table, key_name, strlen(key_name), &kv) != NULL;
+}
+
+static bool coml__add_number(Coml* coml, double value, const char* table_name, const char* key_name) {
+    double* number = (double*)coml__alloc(&coml->allocator, sizeof(double));
+    if (number == NULL) return false;
+
+    *number = value;
+
+    return coml__add_value(coml, table_name, key_name, ComlType_Double, number, 0);
+}
+
+COMLDEF bool coml_add_int(Coml* coml, int value, const char* table_name, const char* key_name) {
+    if (coml == NULL || key_name == NULL) return false;
+
+    return coml__add_number(coml, (double)value, table_name, key_name);
+}
+
+COMLDEF bool coml_add_float(Coml* coml, float value, const char* table_name, const char* key_name) {
+    if (coml == NULL || key_name == NULL) return false;
+
+    return coml__add_number(coml, (double)value, table_name, key_name);
+}
+
+COMLDEF bool coml_add_string(Coml* coml, const char* value, const char* table_name, const char* key_name) {
+    if (coml == NULL || value == NULL || key_name == NULL) return false;
+
+    char* string = coml__strdup(&coml->allocator, value);
+    if (string == NULL) return false;
+
+    return coml__add_value(coml, table_name, key_name, ComlType_String, string, 0);
+}
+
+COMLDEF bool coml_add_bool(Coml* coml, bool value, const char* table_name, const char* key_name) {
+    if (coml == NULL || key_name == NULL) return false;
+
+    bool* boolean = (bool*)coml__alloc(&coml->allocator, sizeof(bool));
+    if (boolean == NULL) return false;
+
+    *boolean = value;
+
+    return coml__add_value(coml, table_name, key_name, ComlType_Boolean, boolean, 0);
+}
+
+COMLDEF bool coml_add_list_double(Coml* coml, const double* value, size_t length, const char* table_name, const char* key_name) {
+    if (coml == NULL || key_name == NULL) return false;
+
+    double* list = NULL;
+    if (length > 0) {
+        list = (double*)coml__alloc(&coml->allocator, sizeof(double)*length);
+        if (list == NULL) return false;
+
+        memcpy(list, value, sizeof(double)*length);
+    }
+
+    return coml__add_value(coml, table_name, key_name, ComlType_ListDouble, list, length);
+}
+
+COMLDEF bool coml_add_list_string(Coml* coml, char** value, size_t length, const char* table_name, const char* key_name) {
+    if (coml == NULL || key_name == NULL) return false;
+
+    char** list = NULL;
+    if (length > 0) {
+        list = (char**)coml__alloc(&coml->allocator, sizeof(char*)*length);
+        if (list == NULL) return false;
+
+        for (size_t i = 0; i < length; ++i) {
+            list[i] = coml__strdup(&coml->allocator, value[i]);
+            if (list[i] == NULL) {
+                coml__free_value(&coml->allocator, ComlType_ListString, list, i);
+                return false;
+            }
+        }
+    }
+
+    return coml__add_value(coml, table_name, key_name, ComlType_ListString, list, length);
+}
+
+COMLDEF bool coml_remove_key(Coml* coml, const char* table_name, const char* key_name) {
+    if (coml == NULL || key_name == NULL) return false;
+
+    Coml_Table* table = coml__edit_table(coml, table_name, false);
+    if (table == NULL) return false;
+
+    Coml_Index_Slot* slot = coml__index_find(&table->index, key_name, strlen(key_name), coml__hash(key_name, strlen(key_name)));
+    if (slot == NULL || slot->is_table) return false;
+
+    coml__remove_node(coml, table, slot);
+
+    return true;
+}
+
+COMLDEF Coml_Table* coml_add_table(Coml* coml, const char* path) {
+    if (coml == NULL) return NULL;
+
+    Coml_Table* table = coml__edit_table(coml, path, true);
+    if (table != NULL) table->is_defined = true;
+
+    return table;
+}
+
+COMLDEF Coml_Table* coml_edit_table(Coml* coml, const char* path) {
+    if (coml == NULL) return NULL;
+
+    return coml__edit_table(coml, path, false);
+}
+
+COMLDEF Coml_Table* coml_edit_table_array_at(Coml* coml, const char* path, size_t index) {
+    if (coml == NULL || path == NULL) return NULL;
+
+    Coml_Index_Slot* slot = coml__lookup_edit(&coml->allocator, coml->root, path);
+    if (slot == NULL || !slot->is_table) return NULL;
+
+    Coml_Table* table = (Coml_Table*)slot->node;
+    if (!table->is_array || index >= table->array_length) return NULL;
+    if (!coml__materialize(&coml->allocator, &table->array[index])) return NULL;
+
+    return &table->array[index];
+}
+
+COMLDEF bool coml_remove_table(Coml* coml, const char* path) {
+    if (coml == NULL || path == NULL) return false;
+
+    size_t start = 0;
+    size_t length = 0;
+    Coml_Table* parent = coml__edit_parent(coml, path, false, &start, &length);
+    if (parent == NULL) return false;
+
+    Coml_Index_Slot* slot = coml__index_find(&parent->index, path+start, length, coml__hash(path+start, length));
+    if (slot == NULL || !slot->is_table) return false;
+
+    coml__remove_node(coml, parent, slot);
+
+    return true;
+}
+static void coml__print_one_kv(const Coml_KV* kv, bool indent) {
+    const char* indent_str = indent ? "    " : "";
+    const char* indent_str2 = indent ? "\t" : "    ";
+
+    switch (kv->type) {
+        case ComlType_Double:
+            if (floor(*(double*)kv->value) == *(double*)kv->value) {
+                printf("%s%s: %.0f\n", indent_str, kv->key, *(double*)kv->value);
+            } else {
+                printf("%s%s: %.10lf\n", indent_str, kv->key, *(double*)kv->value);
+            }
+            break;
+        case ComlType_String:
+            printf("%s%s: %s\n", indent_str, kv->key, (char*)kv->value);
+            break;
+        case ComlType_Boolean:
+            printf("%s%s: %s\n", indent_str, kv->key, *(bool*)kv->value ? "true" : "false");
+            break;
+        case ComlType_ListDouble:
+            printf("%s%s:\n", indent_str, kv->key);
+            for (size_t i = 0; i < kv->list_length; ++i) {
+                if (floor(((double*)kv->value)[i]) == ((double*)kv->value)[i]) {
+                    printf("%s%zu - %.0f\n", indent_str2, i, ((double*)kv->value)[i]);
+                } else {
+                    printf("%s%zu - %.10lf\n", indent_str2, i, ((double*)kv->value)[i]);
+                }
+            }
+            break;
+        case ComlType_ListString:
+            printf("%s%s:\n", indent_str, kv->key);
+            for (size_t i = 0; i < kv->list_length; ++i) {
+                printf("%s%zu - %s\n", indent_str2, i, ((char**)kv->value)[i]);
+            }
+            break;
+        default:
+            printf("%s%s: NULL (default)\n", indent_str, kv->key);
+            break;
+    }
+}
+
+COMLDEF void coml_print_kv(const Coml_KV* kv, bool indent) {
+    if (kv == NULL) return;
+
+    const Coml_KV* last = kv;
+    while (last->next != NULL) last = last->next;
+
+    for (const Coml_KV* iter = last;; iter = iter->prev) {
+        coml__print_one_kv(iter, indent);
+        if (iter == kv) break;
+    }
+}
+
+static void coml__print_path(const Coml__Path* path) {
+    if (path->parent != NULL) {
+        coml__print_path(path->parent);
+        printf(".");
+    }
+
+    printf("%s", path->name);
+    if (path->is_array_entry) printf("[%zu]", path->array_index);
+}
+
+static void coml__print_tables(const Coml_Table* table, const Coml__Path* parent);
+
+static void coml__print_table(const Coml_Table* table, const Coml__Path* parent) {
+    if (table->is_array) {
+        for (size_t i = 0; i < table->array_length; ++i) {
+            Coml_Table* entry = coml__body(&table->array[i]);
+            Coml__Path path = { table->name, parent, true, i };
+
+            printf("Table: ");
+            coml__print_path(&path);
+            printf("\n");
+
+            coml_print_kv(entry->items, true);
+            coml__print_tables(entry->tables, &path);
+        }
+
+        return;
+    }
+
+    Coml__Path path = { table->name, parent, false, 0 };
+    Coml_Table* body = coml__body(table);
+
+    if (body->items != NULL || body->tables == NULL) {
+        printf("Table: ");
+        coml__print_path(&path);
+        printf("\n");
+        
+        Coml_KV* current_kv = body->items;
+        coml_print_kv(current_kv, true);
+    }
+
+    coml__print_tables(body->tables, &path);
+}
+
+static void coml__print_tables(const Coml_Table* table, const Coml__Path* parent) {
+    if (table == NULL) return;
+
+    const Coml_Table* last = table;
+    while (last->next != NULL) last = last->next;
+
+    for (const Coml_Table* iter = last;; iter = iter->prev) {
+        coml__print_table(iter, parent);
+        if (iter == table) break;
+    }
+}
+
+COMLDEF void coml_print_table(const Coml_Table* table) {
+    coml__print_tables(table, NULL);
+}
+
+COMLDEF void coml_print(const Coml* coml) {
+    Coml_Table* root = coml__body(coml->root);
+    Coml_KV* current_item = root->items;
+    coml_print_kv(current_item, false);
+
+    printf("\n");
+
+    Coml_Table* current_table = root->tables;
+    coml_print_table(current_table);
+}
+
+// Buffered output, fewer calls into stdio than writing every character
+typedef struct {
+    FILE* file;
+    size_t length;
+    bool is_failed;
+    char buffer[8192];
+} Coml__Writer;
+
+static void coml__writer_flush(Coml__Writer* writer) {
+    if (writer->length > 0 && fwrite(writer->buffer, 1, writer->length, writer->file) != writer->length) writer->is_failed = true;
+    writer->length = 0;
+}
+
+// At the end only, errors like a full disk show up when the FILE flushes its own buffer
+static void coml__writer_finish(Coml__Writer* writer) {
+    coml__writer_flush(writer);
+    if (fflush(writer->file) != 0 || ferror(writer->file)) writer->is_failed = true;
+}
+
+static void coml__write(Coml__Writer* writer, const char* data, size_t length) {
+    if (writer->length+length > sizeof(writer->buffer)) {
+        coml__writer_flush(writer);
+        if (length > sizeof(writer->buffer)) {
+            if (fwrite(data, 1, length, writer->file) != length) writer->is_failed = true;
+            return;
+        }
+    }
+
+    memcpy(writer->buffer+writer->length, data, length);
+    writer->length += length;
+}
+
+static void coml__write_char(Coml__Writer* writer, char c) {
+    if (writer->length == sizeof(writer->buffer)) coml__writer_flush(writer);
+    writer->buffer[writer->length++] = c;
+}
+
+static void coml__write_json_string(Coml__Writer* writer, const char* string, size_t length) {
+    coml__write_char(writer, '"');
+
+    size_t run = 0;
+    for (size_t i = 0; i < length; ++i) {
+        unsigned char c = (unsigned char)string[i];
+        if (c >= 0x20 && c != '"' && c != '\\' && c != 0x7F) continue;
+
+        coml__write(writer, string+run, i-run);
+        run = i+1;
+
+        char escape[8];
+        switch (c) {
+            case '"': coml__write(writer, "\\\"", 2); break;
+            case '\\': coml__write(writer, "\\\\", 2); break;
+            case '\n': coml__write(writer, "\\n", 2); break;
+            case '\t': coml__write(writer, "\\t", 2); break;
+            case '\r': coml__write(writer, "\\r", 2); break;
+            case '\b': coml__write(writer, "\\b", 2); break;
+            case '\f': coml__write(writer, "\\f", 2); break;
+            default:
+                snprintf(escape, sizeof(escape), "\\u%04X", c);
+                coml__write(writer, escape, 6);
+                break;
+        }
+    }
+    coml__write(writer, string+run, length-run);
+
+    coml__write_char(writer, '"');
+}
+
+// Shortest of %.15g and %.17g that reads back the same, JSON has no nan or inf so they become null
+static void coml__write_json_number(Coml__Writer* writer, double value) {
+    if (isnan(value) || isinf(value)) {
+        coml__write(writer, "null", 4);
+        return;
+    }
+
+    // Integers are the common case and are written without printf
+    char number[32];
+    if (value > -1e15 && value < 1e15 && value == (double)(long long)value) {
+        long long integer = (long long)value;
+        unsigned long long digits = integer < 0 ? (unsigned long long)-integer : (unsigned long long)integer;
+        size_t pos = sizeof(number);
+        do {
+            number[--pos] = (char)('0'+digits%10);
+            digits /= 10;
+        } while (digits > 0);
+        if (integer < 0 || (value == 0 && signbit(value))) number[--pos] = '-';
+
+        coml__write(writer, number+pos, sizeof(number)-pos);
+        return;
+    }
+
+    int length = snprintf(number, sizeof(number), "%.15g", value);
+    if (strtod(number, NULL) != value) length = snprintf(number, sizeof(number), "%.17g", value);
+
+    coml__write(writer, number, (size_t)length);
+}
+
+static void coml__write_json_value(Coml__Writer* writer, const Coml_KV* kv) {
+    switch (kv->type) {
+        case ComlType_Double:
+            coml__write_json_number(writer, *(double*)kv->value);
+            break;
+        case ComlType_String:
+            coml__write_json_string(writer, (char*)kv->value, strlen((char*)kv->value));
+            break;
+        case ComlType_Boolean:
+            if (*(bool*)kv->value) coml__write(writer, "true", 4);
+            else coml__write(writer, "false", 5);
+            break;
+        case ComlType_ListDouble:
+        case ComlType_ListString:
+            coml__write_char(writer, '[');
+            for (size_t i = 0; i < kv->list_length; ++i) {
+                if (i > 0) coml__write_char(writer, ',');
+                if (kv->type == ComlType_ListDouble) {
+                    coml__write_json_number(writer, ((double*)kv->value)[i]);
+                } else {
+                    const char* string = ((char**)kv->value)[i];
+                    coml__write_json_string(writer, string, strlen(string));
+                }
+            }
+            coml__write_char(writer, ']');
+            break;
+    }
+}
+
+// An open JSON object, or an array of tables with its last entry open
+typedef struct {
+    const char* name; // Key of the table's name, which lives until the parent is closed
+    size_t name_length;
+    size_t hash; // Of the path, names below the table are looked up by path
+    size_t id; // Of the table, names below it refer to it by id, 0 for the root
+    size_t first_name; // Names from this one on are below the table, they are dropped when it closes
+    size_t entries;
+    bool is_array;
+    bool is_defined;
+    bool has_members;
+} Coml__Json_Frame;
+
+// Names are looked up by the hash of their path and compared by parent and key, hashes can collide
+typedef struct {
+    size_t hash;
+    size_t parent; // Id of the table the name is in
+    size_t entry; // Entry of the parent if it is an array of tables
+    const char* key; // Into the input, or an owned copy if the key has escapes
+    size_t key_length;
+    bool is_owned;
+    bool is_table;
+} Coml__Json_Name;
+
+// Only the names in open tables are kept. Anything below a closed table can only be reached
+// by reopening it, which is caught by its own name, so memory grows with the open tables only.
+typedef struct {
+    Coml__Writer* writer;
+    Coml__Json_Frame* frames; // frames[0] is the root object
+    size_t frames_length;
+    size_t frames_capacity;
+    size_t header_depth; // Frames after this one were opened by dotted keys
+    Coml__Json_Name* names; // In the order they were written, the names of a table come after the table's own
+    size_t names_length;
+    size_t names_capacity;
+    size_t* slots; // Open addressing index into names, index+1 or 0 for an empty slot
+    size_t slots_capacity;
+    size_t tables_count; // Ids given out to tables
+} Coml__Json;
+
+static size_t coml__json_hash(const Coml__Json_Frame* parent, const char* name, size_t length) {
+    size_t hash = parent->hash;
+    if (parent->is_array) hash = coml__hash_continue(hash, (const char*)&parent->entries, sizeof(parent->entries));
+    hash = coml__hash_continue(hash, ".", 1);
+
+    return coml__hash_continue(hash, name, length);
+}
+
+static Coml__Json_Name* coml__json_find_name(const Coml__Json* json, const Coml__Json_Frame* parent, const char* key, size_t length, size_t hash) {
+    if (json->slots_capacity == 0) return NULL;
+
+    size_t mask = json->slots_capacity-1;
+    for (size_t i = hash & mask; json->slots[i] != 0; i = (i+1) & mask) {
+        Coml__Json_Name* name = &json->names[json->slots[i]-1];
+        if (name->hash == hash && name->parent == parent->id && name->entry == parent->entries &&
+            name->key_length == length && memcmp(name->key, key, length) == 0) {
+            return name;
+        }
+    }
+
+    return NULL;
+}
+
+static void coml__json_index_name(Coml__Json* json, size_t index) {
+    size_t mask = json->slots_capacity-1;
+    size_t i = json->names[index].hash & mask;
+    while (json->slots[i] != 0) i = (i+1) & mask;
+    json->slots[i] = index+1;
+}
+
+// Returns false if out of memory, the caller reports it
+static bool coml__json_add_name(Coml__Parser* parser, Coml__Json* json, const Coml__Json_Frame* parent, const Coml__Segment* segment, size_t hash, bool is_table) {
+    const Coml_Allocator* allocator = parser->allocator;
+
+    if (json->names_length == json->names_capacity) {
+        size_t new_capacity = json->names_capacity == 0 ? 64 : json->names_capacity*2;
+        Coml__Json_Name* new_names = (Coml__Json_Name*)coml__realloc(allocator, json->names, sizeof(Coml__Json_Name)*json->names_capacity, sizeof(Coml__Json_Name)*new_capacity);
+        if (new_names == NULL) return false;
+
+        json->names = new_names;
+        json->names_capacity = new_capacity;
+    }
+
+    if ((json->names_length+1)*4 > json->slots_capacity*3) {
+        size_t new_capacity = json->slots_capacity == 0 ? 128 : json->slots_capacity*2;
+        size_t* new_slots = (size_t*)coml__alloc(allocator, sizeof(size_t)*new_capacity);
+        if (new_slots == NULL) return false;
+        memset(new_slots, 0, sizeof(size_t)*new_capacity);
+
+        coml__free(allocator, json->slots, sizeof(size_t)*json->slots_capacity);
+        json->slots = new_slots;
+        json->slots_capacity = new_capacity;
+        for (size_t i = 0; i < json->names_length; ++i) coml__json_index_name(json, i);
+    }
+
+    Coml__Json_Name name = { hash, parent->id, parent->entries, coml__segment_key(parser, segment), segment->length, segment->is_escaped, is_table };
+
+    // Escaped keys are decoded into the scratch buffer, which the next line reuses
+    if (name.is_owned) {
+        name.key = coml__strndup(allocator, name.key, name.key_length);
+        if (name.key == NULL) return false;
+    }
+
+    json->names[json->names_length] = name;
+    coml__json_index_name(json, json->names_length++);
+
+    return true;
+}
+
+// Drops the names from length on, newest first, each slot is emptied by moving later ones of its run back
+static void coml__json_drop_names(const Coml_Allocator* allocator, Coml__Json* json, size_t length) {
+    size_t mask = json->slots_capacity-1;
+
+    while (json->names_length > length) {
+        size_t index = --json->names_length;
+        const Coml__Json_Name* name = &json->names[index];
+
+        size_t i = name->hash & mask;
+        while (json->slots[i] != index+1) i = (i+1) & mask;
+
+        for (size_t j = (i+1) & mask; json->slots[j] != 0; j = (j+1) & mask) {
+            size_t home = json->names[json->slots[j]-1].hash & mask;
+            if (((j-home) & mask) >= ((j-i) & mask)) {
+                json->slots[i] = json->slots[j];
+                i = j;
+            }
+        }
+        json->slots[i] = 0;
+
+        if (name->is_owned) coml__free(allocator, (char*)name->key, name->key_length+1);
+    }
+}
+
+static void coml__json_free_names(const Coml_Allocator* allocator, Coml__Json* json) {
+    coml__json_drop_names(allocator, json, 0);
+
+    coml__free(allocator, json->names, sizeof(Coml__Json_Name)*json->names_capacity);
+    coml__free(allocator, json->slots, sizeof(size_t)*json->slots_capacity);
+}
+
+static void coml__json_member(Coml__Json* json, const char* name, size_t length) {
+    Coml__Json_Frame* top = &json->frames[json->frames_length-1];
+    if (top->has_members) coml__write_char(json->writer, ',');
+    top->has_members = true;
+
+    coml__write_json_string(json->writer, name, length);
+    coml__write_char(json->writer, ':');
+}
+
+static bool coml__json_open(Coml__Parser* parser, Coml__Json* json, const Coml__Segment* segment, bool is_array, bool is_defined) {
+    const Coml__Json_Frame* parent = &json->frames[json->frames_length-1];
+    const char* name = coml__segment_key(parser, segment);
+    size_t hash = coml__json_hash(parent, name, segment->length);
+
+    Coml__Json_Name* existing = coml__json_find_name(json, parent, name, segment->length, hash);
+    if (existing != NULL && !existing->is_table) {
+        return coml__fail(parser, ComlError_DuplicateKey, segment->offset, "key is already defined as a value");
+    }
+    if (existing != NULL) {
+        return coml__fail(parser, ComlError_Unsupported, segment->offset, "table is split up, it has to be in one place to be streamed");
+    }
+
+    if (json->frames_length == json->frames_capacity) {
+        size_t new_capacity = json->frames_capacity*2;
+        Coml__Json_Frame* new_frames = (Coml__Json_Frame*)coml__realloc(parser->allocator, json->frames, sizeof(Coml__Json_Frame)*json->frames_capacity, sizeof(Coml__Json_Frame)*new_capacity);
+        if (new_frames == NULL) return coml__fail(parser, ComlError_OutOfMemory, segment->offset, "out of memory");
+
+        json->frames = new_frames;
+        json->frames_capacity = new_capacity;
+        parent = &json->frames[json->frames_length-1];
+    }
+
+    if (!coml__json_add_name(parser, json, parent, segment, hash, true)) return coml__fail(parser, ComlError_OutOfMemory, segment->offset, "out of memory");
+
+    const char* key = json->names[json->names_length-1].key;
+    Coml__Json_Frame frame = { key, segment->length, hash, ++json->tables_count, json->names_length, 1, is_array, is_defined, false };
+
+    coml__json_member(json, key, segment->length);
+    coml__write(json->writer, is_array ? "[{" : "{", is_array ? 2 : 1);
+    json->frames[json->frames_length++] = frame;
+
+    return true;
+}
+
+static void coml__json_close_to(Coml__Parser* parser, Coml__Json* json, size_t depth) {
+    while (json->frames_length > depth) {
+        Coml__Json_Frame* frame = &json->frames[--json->frames_length];
+        coml__write(json->writer, frame->is_array ? "}]" : "}", frame->is_array ? 2 : 1);
+        coml__json_drop_names(parser->allocator, json, frame->first_name);
+    }
+}
+
+// How many of the segments from first on match the open frames from depth on
+static size_t coml__json_match(Coml__Parser* parser, const Coml__Json* json, size_t depth, size_t first, size_t count) {
+    size_t matched = 0;
+    while (matched < count && depth+matched < json->frames_length) {
+        const Coml__Segment* segment = &parser->segments[first+matched];
+        const Coml__Json_Frame* frame = &json->frames[depth+matched];
+        if (frame->name_length != segment->length || memcmp(frame->name, coml__segment_key(parser, segment), segment->length) != 0) break;
+        ++matched;
+    }
+
+    return matched;
+}
+
+static bool coml__json_header(Coml__Parser* parser, size_t start, bool is_array) {
+    Coml__Json* json = (Coml__Json*)parser->sink;
+    size_t count = parser->segments_length;
+    size_t matched = coml__json_match(parser, json, 1, 0, count);
+
+    if (matched == count) {
+        Coml__Json_Frame* frame = &json->frames[count];
+        if (frame->is_array != is_array) {
+            return coml__fail(parser, ComlError_DuplicateKey, start, is_array ? "table is already defined as a plain table" : "table is already defined as an array of tables");
+        }
+        if (!is_array && frame->is_defined) {
+            return coml__fail(parser, ComlError_DuplicateKey, start, "table is defined more than once");
+        }
+
+        coml__json_close_to(parser, json, count+1);
+        if (is_array) {
+            coml__write(json->writer, "},{", 3);
+            coml__json_drop_names(parser->allocator, json, frame->first_name);
+            frame->entries += 1;
+            frame->has_members = false;
+        }
+        frame->is_defined = true;
+    } else {
+        coml__json_close_to(parser, json, matched+1);
+        for (size_t i = matched; i < count; ++i) {
+            bool is_last = i+1 == count;
+            if (!coml__json_open(parser, json, &parser->segments[i], is_array && is_last, is_last)) return false;
+        }
+    }
+
+    json->header_depth = count;
+
+    return true;
+}
+
+static bool coml__json_kv(Coml__Parser* parser, size_t start, Coml_KV* value) {
+    Coml__Json* json = (Coml__Json*)parser->sink;
+    size_t count = parser->segments_length-1;
+    size_t matched = coml__json_match(parser, json, json->header_depth+1, 0, count);
+
+    coml__json_close_to(parser, json, json->header_depth+1+matched);
+    bool res = true;
+    for (size_t i = matched; res && i < count; ++i) {
+        res = coml__json_open(parser, json, &parser->segments[i], false, true);
+    }
+
+    const Coml__Segment* segment = &parser->segments[count];
+    const Coml__Json_Frame* parent = &json->frames[json->frames_length-1];
+    const char* key = coml__segment_key(parser, segment);
+    size_t hash = coml__json_hash(parent, key, segment->length);
+    if (res && coml__json_find_name(json, parent, key, segment->length, hash) != NULL) {
+        res = coml__fail(parser, ComlError_DuplicateKey, segment->offset, "key is defined more than once");
+    }
+    if (res && !coml__json_add_name(parser, json, parent, segment, hash, false)) res = coml__fail(parser, ComlError_OutOfMemory, start, "out of memory");
+
+    if (res) {
+        coml__json_member(json, key, segment->length);
+        coml__write_json_value(json->writer, value);
+    }
+
+    coml__free_value(parser->allocator, value->type, value->value, value->list_length);
+
+    return res;
+}
+
+COMLDEF bool coml_toml_to_json(const char* content, size_t length, FILE* file, const Coml_Options* options, Coml_Error* error) {
+    if (content == NULL || length == 0) return coml__set_error(error, ComlError_EmptyInput, 0, "empty input");
+
+    const Coml_Limits* limits = options != NULL ? options->limits : NULL;
+    if (limits != NULL && coml__exceeds(limits->max_input_bytes, length)) {
+        return coml__set_error(error, ComlError_LimitExceeded, 0, "input is too large");
+    }
+
+    Coml_Allocator base = options != NULL && options->allocator != NULL ? *options->allocator : coml_default_allocator();
+    Coml__Budget budget;
+    Coml_Allocator allocator = coml__budget_allocator(&budget, &base, limits);
+
+    Coml__Writer* writer = (Coml__Writer*)coml__alloc(&allocator, sizeof(Coml__Writer));
+    Coml__Json_Frame* frames = (Coml__Json_Frame*)coml__alloc(&allocator, sizeof(Coml__Json_Frame)*8);
+    if (writer == NULL || frames == NULL) {
+        coml__free(&allocator, writer, sizeof(Coml__Writer));
+        coml__free(&allocator, frames, sizeof(Coml__Json_Frame)*8);
+        coml__set_error(error, ComlError_OutOfMemory, 0, "out of memory");
+        coml__budget_error(&budget, error);
+        return false;
+    }
+    writer->file = file;
+    writer->length = 0;
+    writer->is_failed = false;
+
+    Coml__Json json;
+    memset(&json, 0, sizeof(Coml__Json));
+    json.writer = writer;
+    json.frames = frames;
+    json.frames_capacity = 8;
+    memset(&json.frames[0], 0, sizeof(Coml__Json_Frame));
+    json.frames[0].hash = COML__HASH_BASIS;
+    json.frames_length = 1;
+
+    Coml__Parser parser;
+    memset(&parser, 0, sizeof(Coml__Parser));
+    parser.allocator = &allocator;
+    parser.content = content;
+    parser.length = length;
+    parser.error = error;
+    parser.sink = &json;
+    parser.limits = limits;
+
+    coml__write_char(writer, '{');
+
+    Coml__Handler handler = { coml__json_header, coml__json_kv };
+    bool res = coml__parse_lines(&parser, &handler);
+
+    // After an error the output is left open, closing it would make it look complete
+    if (res) {
+        coml__json_close_to(&parser, &json, 1);
+        coml__write(writer, "}\n", 2);
+    }
+    coml__writer_finish(writer);
+    if (res && writer->is_failed) res = coml__set_error(error, ComlError_WriteFailed, 0, "could not write the output");
+
+    coml__parser_free(&parser);
+    coml__json_free_names(&allocator, &json);
+    coml__free(&allocator, json.frames, sizeof(Coml__Json_Frame)*json.frames_capacity);
+    coml__free(&allocator, writer, sizeof(Coml__Writer));
+
+    if (!res) {
+        coml__budget_error(&budget, error);
+        coml__locate_error(error, content, length);
+    }
+
+    return res;
+}
+
+static void coml__write_json_table(Coml__Writer* writer, const Coml_Table* table) {
+    const Coml_Table* body = coml__body(table);
+    bool has_members = false;
+    coml__write_char(writer, '{');
+
+    const Coml_KV* kv = body->items;
+    while (kv != NULL && kv->next != NULL) kv = kv->next;
+    for (; kv != NULL; kv = kv->prev) {
+        if (has_members) coml__write_char(writer, ',');
+        has_members = true;
+
+        coml__write_json_string(writer, kv->key, strlen(kv->key));
+        coml__write_char(writer, ':');
+        coml__write_json_value(writer, kv);
+    }
+
+    // Siblings are walked in a loop, only nesting recurses
+    const Coml_Table* child = body->tables;
+    while (child != NULL && child->next != NULL) child = child->next;
+    for (; child != NULL; child = child->prev) {
+        if (has_members) coml__write_char(writer, ',');
+        has_members = true;
+
+        coml__write_json_string(writer, child->name, strlen(child->name));
+        coml__write_char(writer, ':');
+        if (!child->is_array) {
+            coml__write_json_table(writer, child);
+            continue;
+        }
+
+        coml__write_char(writer, '[');
+        for (size_t i = 0; i < child->array_length; ++i) {
+            if (i > 0) coml__write_char(writer, ',');
+            coml__write_json_table(writer, &child->array[i]);
+        }
+        coml__write_char(writer, ']');
+    }
+
+    coml__write_char(writer, '}');
+}
+
+COMLDEF bool coml_write_json(Coml* coml, FILE* file) {
+    if (coml == NULL || file == NULL) return false;
+
+    Coml__Writer* writer = (Coml__Writer*)coml__alloc(&coml->allocator, sizeof(Coml__Writer));
+    if (writer == NULL) return false;
+    writer->file = file;
+    writer->length = 0;
+    writer->is_failed = false;
+
+    coml__write_json_table(writer, coml->root);
+    coml__write_char(writer, '\n');
+    coml__writer_finish(writer);
+
+    bool res = !writer->is_failed;
+    coml__free(&coml->allocator, writer, sizeof(Coml__Writer));
+
+    return res;
+}
+
+static void coml__skip_json_space(Coml__Parser* parser) {
+    while (parser->pos < parser->length) {
+        char c = parser->content[parser->pos];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') return;
+        ++parser->pos;
+    }
+}
+
+// Stops once the length is over max_length like coml__decode_basic
+static bool coml__decode_json(Coml__Parser* parser, size_t start, size_t end, size_t max_length, char* out, size_t* out_length) {
+    const char* content = parser->content;
+    size_t length = 0;
+    size_t i = start;
+
+    while (i < end && !coml__exceeds(max_length, length)) {
+        char c = content[i];
+        if (c != '\\') {
+            if ((unsigned char)c < 0x20) return coml__fail(parser, ComlError_InvalidValue, i, "control characters have to be escaped");
+            if (out != NULL) out[length] = c;
+            ++length;
+            ++i;
+            continue;
+        }
+
+        char escape = i+1 < end ? content[i+1] : '\0';
+        char decoded = '\0';
+        switch (escape) {
+            case 'b': decoded = '\b'; break;
+            case 't': decoded = '\t'; break;
+            case 'n': decoded = '\n'; break;
+            case 'f': decoded = '\f'; break;
+            case 'r': decoded = '\r'; break;
+            case '"': decoded = '"'; break;
+            case '\\': decoded = '\\'; break;
+            case '/': decoded = '/'; break;
+            case 'u': {
+                unsigned long codepoint = 0;
+                size_t digits = 4;
+                for (size_t k = 0; k < 4; ++k) {
+                    int digit = i+2+k < end ? coml__hex_value(content[i+2+k]) : -1;
+                    if (digit < 0) return coml__fail(parser, ComlError_InvalidValue, i, "invalid unicode escape");
+                    codepoint = codepoint*16+(unsigned long)digit;
+                }
+
+                // Characters outside the BMP are written as a surrogate pair
+                if (codepoint >= 0xD800 && codepoint <= 0xDBFF) {
+                    unsigned long low = 0;
+                    if (i+12 > end || content[i+6] != '\\' || content[i+7] != 'u') {
+                        return coml__fail(parser, ComlError_InvalidValue, i, "invalid unicode escape");
+                    }
+                    for (size_t k = 0; k < 4; ++k) {
+                        int digit = coml__hex_value(content[i+8+k]);
+                        if (digit < 0) return coml__fail(parser, ComlError_InvalidValue, i, "invalid unicode escape");
+                        low = low*16+(unsigned long)digit;
+                    }
+                    if (low < 0xDC00 || low > 0xDFFF) return coml__fail(parser, ComlError_InvalidValue, i, "invalid unicode escape");
+
+                    codepoint = 0x10000+((codepoint-0xD800) << 10)+(low-0xDC00);
+                    digits = 10;
+                } else if (codepoint >= 0xDC00 && codepoint <= 0xDFFF) {
+                    return coml__fail(parser, ComlError_InvalidValue, i, "invalid unicode escape");
+                }
+
+                // NUL can't be represented in the returned C strings
+                if (codepoint == 0) return coml__fail(parser, ComlError_InvalidValue, i, "strings can't contain NUL");
+
+                length += coml__encode_utf8(codepoint, out != NULL ? out+length : NULL);
+                i += 2+digits;
+                continue;
+            }
+            default:
+                return coml__fail(parser, ComlError_InvalidValue, i, "invalid escape sequence");
+        }
+
+        if (out != NULL) out[length] = decoded;
+        ++length;
+        i += 2;
+    }
+
+    *out_length = length;
+    return true;
+}
+
+static bool coml__parse_json_string(Coml__Parser* parser, char** out, size_t* out_length) {
+    size_t open = parser->pos;
+    if (coml__peek(parser, 0) != '"') return coml__fail(parser, ComlError_InvalidValue, open, "expected a string");
+
+    size_t end = open+1;
+    while (end < parser->length && parser->content[end] != '"') {
+        end += parser->content[end] == '\\' ? 2 : 1;
+    }
+    if (end >= parser->length) return coml__fail(parser, ComlError_UnterminatedString, open, "unterminated string");
+
+    // Measured up to the limit first if the body is over it, like TOML strings
+    size_t length = end-open-1;
+    size_t max_length = parser->limits != NULL ? parser->limits->max_string_length : 0;
+    if (coml__exceeds(max_length, length)) {
+        if (!coml__decode_json(parser, open+1, end, max_length, NULL, &length)) return false;
+        if (coml__exceeds(max_length, length)) return coml__fail(parser, ComlError_LimitExceeded, open, "string is too long");
+    }
+
+    if (!coml__decode_json(parser, open+1, end, 0, NULL, &length)) return false;
+
+    char* string = (char*)coml__alloc(parser->allocator, length+1);
+    if (string == NULL) return coml__fail(parser, ComlError_OutOfMemory, open, "out of memory");
+
+    coml__decode_json(parser, open+1, end, 0, string, &length);
+    string[length] = '\0';
+
+    parser->pos = end+1;
+    *out = string;
+    if (out_length != NULL) *out_length = length;
+    return true;
+}
+
+static bool coml__parse_json_number(Coml__Parser* parser, double* out) {
+    const char* content = parser->content;
+    size_t start = parser->pos;
+    size_t i = start;
+
+    if (i < parser->length && content[i] == '-') ++i;
+    if (i < parser->length && content[i] == '0') {
+        ++i;
+    } else if (i < parser->length && content[i] >= '1' && content[i] <= '9') {
+        while (i < parser->length && content[i] >= '0' && content[i] <= '9') ++i;
+    } else {
+        return coml__fail(parser, ComlError_InvalidValue, start, "invalid value");
+    }
+    if (i < parser->length && content[i] == '.') {
+        size_t digits = ++i;
+        while (i < parser->length && content[i] >= '0' && content[i] <= '9') ++i;
+        if (i == digits) return coml__fail(parser, ComlError_InvalidValue, start, "invalid number");
+    }
+    if (i < parser->length && (content[i] == 'e' || content[i] == 'E')) {
+        ++i;
+        if (i < parser->length && (content[i] == '+' || content[i] == '-')) ++i;
+        size_t digits = i;
+        while (i < parser->length && content[i] >= '0' && content[i] <= '9') ++i;
+        if (i == digits) return coml__fail(parser, ComlError_InvalidValue, start, "invalid number");
+    }
+
+    char buffer[128];
+    if (i-start >= sizeof(buffer)) return coml__fail(parser, ComlError_InvalidValue, start, "number is too long");
+    memcpy(buffer, content+start, i-start);
+    buffer[i-start] = '\0';
+
+    *out = strtod(buffer, NULL);
+    parser->pos = i;
+    return true;
+}
+
+// Scalars and arrays of scalars, arrays of objects are handled by coml_from_json
+static bool coml__parse_json_value(Coml__Parser* parser, Coml_KV* kv) {
+    size_t start = parser->pos;
+    char c = coml__peek(parser, 0);
+    memset(kv, 0, sizeof(Coml_KV));
+
+    if (c == '"') {
+        kv->type = ComlType_String;
+        return coml__parse_json_string(parser, (char**)&kv->value, NULL);
+    }
+
+    if (c == 't' || c == 'f') {
+        bool boolean = c == 't';
+        const char* word = boolean ? "true" : "false";
+        size_t word_length = strlen(word);
+        if (parser->length-start < word_length || memcmp(parser->content+start, word, word_length) != 0) {
+            return coml__fail(parser, ComlError_InvalidValue, start, "invalid value");
+        }
+        parser->pos += word_length;
+
+        kv->value = coml__alloc(parser->allocator, sizeof(bool));
+        if (kv->value == NULL) return coml__fail(parser, ComlError_OutOfMemory, start, "out of memory");
+
+        *(bool*)kv->value = boolean;
+        kv->type = ComlType_Boolean;
+        return true;
+    }
+
+    if (c == 'n') return coml__fail(parser, ComlError_Unsupported, start, "null is not supported");
+
+    if (c == '[') {
+        ++parser->pos;
+        coml__skip_json_space(parser);
+
+        kv->type = coml__peek(parser, 0) == '"' ? ComlType_ListString : ComlType_ListDouble;
+        size_t item_size = kv->type == ComlType_ListString ? sizeof(char*) : sizeof(double);
+        size_t capacity = 0;
+
+        bool res = true;
+        while (res && coml__peek(parser, 0) != ']') {
+            if (kv->list_length > 0) {
+                if (coml__peek(parser, 0) != ',') {
+                    res = coml__fail(parser, ComlError_InvalidValue, parser->pos, "expected ',' or ']'");
+                    break;
+                }
+                ++parser->pos;
+                coml__skip_json_space(parser);
+            }
+
+            char item = coml__peek(parser, 0);
+            if (item == '[' || item == '{') {
+                res = coml__fail(parser, ComlError_Unsupported, parser->pos, "nested arrays are not supported");
+                break;
+            }
+            if ((item == '"') != (kv->type == ComlType_ListString)) {
+                res = coml__fail(parser, ComlError_Unsupported, parser->pos, "lists with mixed types are not supported");
+                break;
+            }
+            if (parser->limits != NULL && coml__exceeds(parser->limits->max_list_length, kv->list_length+1)) {
+                res = coml__fail(parser, ComlError_LimitExceeded, parser->pos, "list is too long");
+                break;
+            }
+
+            if (kv->list_length == capacity) {
+                size_t new_capacity = capacity == 0 ? 8 : capacity*2;
+                void* new_items = coml__realloc(parser->allocator, kv->value, item_size*capacity, item_size*new_capacity);
+                if (new_items == NULL) {
+                    res = coml__fail(parser, ComlError_OutOfMemory, parser->pos, "out of memory");
+                    break;
+                }
+                kv->value = new_items;
+                capacity = new_capacity;
+            }
+
+            if (kv->type == ComlType_ListString) {
+                res = coml__parse_json_string(parser, &((char**)kv->value)[kv->list_length], NULL);
+            } else {
+                res = coml__parse_json_number(parser, &((double*)kv->value)[kv->list_length]);
+            }
+            if (res) kv->list_length += 1;
+            coml__skip_json_space(parser);
+        }
+
+        // Shrunk to the exact size, frees are sized by list_length
+        void* items = NULL;
+        if (res && kv->list_length > 0) {
+            items = coml__realloc(parser->allocator, kv->value, item_size*capacity, item_size*kv->list_length);
+            if (items == NULL) res = coml__fail(parser, ComlError_OutOfMemory, parser->pos, "out of memory");
+        }
+
+        if (!res || kv->list_length == 0) {
+            for (size_t i = 0; kv->type == ComlType_ListString && i < kv->list_length; ++i) {
+                coml__free_string(parser->allocator, ((char**)kv->value)[i]);
+            }
+            coml__free(parser->allocator, kv->value, item_size*capacity);
+        }
+        kv->value = items;
+
+        if (!res) {
+            kv->list_length = 0;
+            return false;
+        }
+
+        ++parser->pos;
+        return true;
+    }
+
+    double number = 0;
+    if (!coml__parse_json_number(parser, &number)) return false;
+
+    kv->value = coml__alloc(parser->allocator, sizeof(double));
+    if (kv->value == NULL) return coml__fail(parser, ComlError_OutOfMemory, start, "out of memory");
+
+    *(double*)kv->value = number;
+    kv->type = ComlType_Double;
+    return true;
+}
+
+// An open object, or an array of objects when array_name is set
+typedef struct {
+    Coml_Table* table;
+    char* array_name;
+    bool is_first;
+} Coml__Json_Level;
+
+static bool coml__push_json_level(Coml__Parser* parser, Coml__Json_Level** levels, size_t* length, size_t* capacity, Coml_Table* table, char* array_name) {
+    // The root object is not nested
+    if (parser->limits != NULL && coml__exceeds(parser->limits->max_depth, *length)) {
+        coml__free_string(parser->allocator, array_name);
+        return coml__fail(parser, ComlError_LimitExceeded, parser->pos, "objects are nested too deeply");
+    }
+
+    if (*length == *capacity) {
+        size_t new_capacity = *capacity == 0 ? 16 : *capacity*2;
+        Coml__Json_Level* new_levels = (Coml__Json_Level*)coml__realloc(parser->allocator, *levels, sizeof(Coml__Json_Level)*(*capacity), sizeof(Coml__Json_Level)*new_capacity);
+        if (new_levels == NULL) {
+            coml__free_string(parser->allocator, array_name);
+            return coml__fail(parser, ComlError_OutOfMemory, parser->pos, "out of memory");
+        }
+
+        *levels = new_levels;
+        *capacity = new_capacity;
+    }
+
+    Coml__Json_Level level = { table, array_name, true };
+    (*levels)[(*length)++] = level;
+
+    return true;
+}
+
+// One member of an object, objects and arrays of objects are pushed as new levels
+static bool coml__parse_json_member(Coml__Parser* parser, Coml__Json_Level** levels, size_t* length, size_t* capacity) {
+    Coml_Table* table = (*levels)[*length-1].table;
+
+    size_t key_offset = parser->pos;
+    parser->nodes += 1;
+    if (parser->limits != NULL && coml__exceeds(parser->limits->max_nodes, parser->nodes)) {
+        return coml__fail(parser, ComlError_LimitExceeded, key_offset, "too many keys and tables");
+    }
+
+    char* key = NULL;
+    size_t key_length = 0;
+    if (!coml__parse_json_string(parser, &key, &key_length)) return false;
+
+    bool res = true;
+    coml__skip_json_space(parser);
+    if (coml__peek(parser, 0) != ':') {
+        res = coml__fail(parser, ComlError_ExpectedEquals, parser->pos, "expected ':' after key");
+    } else {
+        ++parser->pos;
+        coml__skip_json_space(parser);
+    }
+
+    if (res && coml__index_find(&table->index, key, key_length, coml__hash(key, key_length)) != NULL) {
+        res = coml__fail(parser, ComlError_DuplicateKey, key_offset, "key is defined more than once");
+    }
+    if (!res) {
+        coml__free_string(parser->allocator, key);
+        return false;
+    }
+
+    size_t start = parser->pos;
+    if (coml__peek(parser, 0) == '{') {
+        ++parser->pos;
+        Coml_Table* child = coml__add_child(parser->allocator, table, key, key_length);
+        coml__free_string(parser->allocator, key);
+        if (child == NULL) return coml__fail(parser, ComlError_OutOfMemory, start, "out of memory");
+
+        child->is_defined = true;
+        return coml__push_json_level(parser, levels, length, capacity, child, NULL);
+    }
+
+    if (coml__peek(parser, 0) == '[') {
+        ++parser->pos;
+        coml__skip_json_space(parser);
+        if (coml__peek(parser, 0) == '{') return coml__push_json_level(parser, levels, length, capacity, table, key);
+        parser->pos = start;
+    }
+
+    Coml_KV value;
+    res = coml__parse_json_value(parser, &value);
+    if (res && coml__attach_kv(parser->allocator, table, key, key_length, &value) == NULL) {
+        res = coml__fail(parser, ComlError_OutOfMemory, start, "out of memory");
+    }
+    coml__free_string(parser->allocator, key);
+
+    return res;
+}
+
+COMLDEF Coml* coml_from_json(const char* content, size_t length, const Coml_Options* options, Coml_Error* error) {
+    coml__set_error(error, ComlError_None, 0, NULL);
+
+    if (content == NULL || length == 0) {
+        coml__set_error(error, ComlError_EmptyInput, 0, "empty input");
+        return NULL;
+    }
+
+    const Coml_Limits* limits = options != NULL ? options->limits : NULL;
+    if (limits != NULL && coml__exceeds(limits->max_input_bytes, length)) {
+        coml__set_error(error, ComlError_LimitExceeded, 0, "input is too large");
+        return NULL;
+    }
+
+    Coml* coml = coml_new(options);
+    if (coml == NULL) {
+        coml__set_error(error, ComlError_OutOfMemory, 0, "out of memory");
+        return NULL;
+    }
+
+    Coml__Budget budget;
+    Coml_Allocator allocator = coml->allocator;
+    coml->allocator = coml__budget_allocator(&budget, &allocator, limits);
+
+    Coml__Parser parser;
+    memset(&parser, 0, sizeof(Coml__Parser));
+    parser.coml = coml;
+    parser.allocator = &coml->allocator;
+    parser.content = content;
+    parser.length = length;
+    parser.error = error;
+    parser.limits = limits;
+
+    // An explicit stack, deeply nested input can't overflow the call stack
+    Coml__Json_Level* levels = NULL;
+    size_t levels_length = 0;
+    size_t levels_capacity = 0;
+
+    coml__skip_json_space(&parser);
+    bool res = true;
+    if (coml__peek(&parser, 0) != '{') {
+        res = coml__fail(&parser, ComlError_InvalidValue, parser.pos, "expected an object");
+    } else {
+        ++parser.pos;
+        res = coml__push_json_level(&parser, &levels, &levels_length, &levels_capacity, coml->root, NULL);
+    }
+
+    while (res && levels_length > 0) {
+        Coml__Json_Level* level = &levels[levels_length-1];
+        bool is_array = level->array_name != NULL;
+        char close = is_array ? ']' : '}';
+
+        coml__skip_json_space(&parser);
+        if (coml__peek(&parser, 0) == close) {
+            ++parser.pos;
+            coml__free_string(parser.allocator, level->array_name);
+            --levels_length;
+            continue;
+        }
+
+        if (!level->is_first) {
+            if (coml__peek(&parser, 0) != ',') {
+                res = coml__fail(&parser, ComlError_InvalidValue, parser.pos, is_array ? "expected ',' or ']'" : "expected ',' or '}'");
+                break;
+            }
+            ++parser.pos;
+            coml__skip_json_space(&parser);
+        }
+        level->is_first = false;
+
+        if (!is_array) {
+            res = coml__parse_json_member(&parser, &levels, &levels_length, &levels_capacity);
+            continue;
+        }
+
+        if (coml__peek(&parser, 0) != '{') {
+            res = coml__fail(&parser, ComlError_Unsupported, parser.pos, "arrays of objects can't contain other values");
+            break;
+        }
+        ++parser.pos;
+
+        parser.nodes += 1;
+        if (limits != NULL && coml__exceeds(limits->max_nodes, parser.nodes)) {
+            res = coml__fail(&parser, ComlError_LimitExceeded, parser.pos-1, "too many keys and tables");
+            break;
+        }
+
+        Coml_Table* entry = coml_append_table_array(parser.allocator, level->table, level->array_name);
+        if (entry == NULL) {
+            res = coml__fail(&parser, ComlError_OutOfMemory, parser.pos, "out of memory");
+            break;
+        }
+        entry->is_defined = true;
+        res = coml__push_json_level(&parser, &levels, &levels_length, &levels_capacity, entry, NULL);
+    }
+
+    if (res) {
+        coml__skip_json_space(&parser);
+        if (parser.pos != parser.length) res = coml__fail(&parser, ComlError_InvalidValue, parser.pos, "unexpected content after the object");
+    }
+
+    for (size_t i = 0; i < levels_length; ++i) coml__free_string(parser.allocator, levels[i].array_name);
+    coml__free(parser.allocator, levels, sizeof(Coml__Json_Level)*levels_capacity);
+    coml__parser_free(&parser);
+
+    coml->allocator = allocator;
+
+    if (!res) {
+        coml__budget_error(&budget, error);
+        coml__locate_error(error, content, length);
+        coml_free(coml);
+        return NULL;
+    }
+
+    return coml;
+}
+
+COMLDEF const Coml_KV* coml_overlay_get_kv(const Coml_Overlay* overlay, const char* table_name, const char* key_name) {
+    if (overlay == NULL) return NULL;
+
+    for (size_t i = overlay->layers_length; i > 0; --i) {
+        const Coml_KV* kv = coml__get_kv(overlay->layers[i-1], table_name, key_name);
+        if (kv != NULL) return kv;
+    }
+
+    return NULL;
+}
+
+COMLDEF void* coml_overlay_get_value_raw(const Coml_Overlay* overlay, Coml_Type type, const char* table_name, const char* key_name) {
+    const Coml_KV* kv = coml_overlay_get_kv(overlay, table_name == NULL ? "" : table_name, key_name);
+    if (kv == NULL || kv->type != type) return NULL;
+
+    return kv->value;
+}
+
+COMLDEF int coml_overlay_get_int(const Coml_Overlay* overlay, const char* table_name, const char* key_name) {
+    void* value = coml_overlay_get_value_raw(overlay, ComlType_Double, table_name, key_name);
+    if (value == NULL) return 0;
+
+    return (int)*(double*)value;
+}
+
+COMLDEF float coml_overlay_get_float(const Coml_Overlay* overlay, const char* table_name, const char* key_name) {
+    void* value = coml_overlay_get_value_raw(overlay, ComlType_Double, table_name, key_name);
+    if (value == NULL) return 0.f;
+
+    return (float)*(double*)value;
+}
+
+COMLDEF char* coml_overlay_get_string(const Coml_Overlay* overlay, const char* table_name, const char* key_name) {
+    void* value = coml_overlay_get_value_raw(overlay, ComlType_String, table_name, key_name);
+    if (value == NULL) return NULL;
+
+    return (char*)value;
+}
+
+COMLDEF bool coml_overlay_get_bool(const Coml_Overlay* overlay, const char* table_name, const char* key_name) {
+    void* value = coml_overlay_get_value_raw(overlay, ComlType_Boolean, table_name, key_name);
+    if (value == NULL) return false;
+
+    return *(bool*)value;
+}
+
+COMLDEF double* coml_overlay_get_list_double(const Coml_Overlay* overlay, const char* table_name, const char* key_name) {
+    void* value = coml_overlay_get_value_raw(overlay, ComlType_ListDouble, table_name, key_name);
+    if (value == NULL) return NULL;
+
+    return (double*)value;
+}
+
+COMLDEF char** coml_overlay_get_list_string(const Coml_Overlay* overlay, const char* table_name, const char* key_name) {
+    void* value = coml_overlay_get_value_raw(overlay, ComlType_ListString, table_name, key_name);
+    if (value == NULL) return NULL;
+
+    return (char**)value;
+}
+
+static size_t coml__mix(size_t hash, size_t displacement) {
+    unsigned long long x = (unsigned long long)hash ^ ((unsigned long long)displacement*0x9E3779B97F4A7C15ULL);
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+
+    return (size_t)x;
+}
+
+static size_t coml__field_hash(const char* table, const char* key) {
+    size_t hash = coml__hash_continue(COML__HASH_BASIS, table, strlen(table));
+    hash = coml__hash_continue(hash, "", 1);
+    return coml__hash_continue(hash, key, strlen(key));
+}
+
+// Hash-and-displace: buckets are placed largest first, each one gets the
+// first displacement that sends all of its fields into free slots
+COMLDEF void coml_schema_prepare(Coml_Schema* schema) {
+    if (schema == NULL || schema->is_prepared) return;
+
+    size_t n = schema->fields_length;
+    size_t slots_length = n*2;
+    for (size_t i = 0; i < n; ++i) {
+        schema->fields[i].hash = coml__field_hash(schema->fields[i].table, schema->fields[i].key);
+        schema->displacements[i] = 0;
+    }
+    for (size_t i = 0; i < slots_length; ++i) schema->slots[i] = 0;
+
+    // starts (n+1), members (n), order (n) and sizes (n+1), on the stack for small schemas
+    size_t scratch_buffer[4*64+2];
+    size_t scratch_length = 4*n+2;
+    size_t* scratch = scratch_buffer;
+    Coml_Allocator allocator = coml_default_allocator();
+    if (scratch_length > sizeof(scratch_buffer)/sizeof(size_t)) {
+        scratch = (size_t*)coml__alloc(&allocator, sizeof(size_t)*scratch_length);
+        if (scratch == NULL) {
+            schema->is_perfect = false;
+            schema->is_prepared = true;
+            return;
+        }
+    }
+    memset(scratch, 0, sizeof(size_t)*scratch_length);
+
+    size_t* starts = scratch; // Fields of bucket b are members[starts[b]] to members[starts[b+1]-1]
+    size_t* members = starts+n+1;
+    size_t* order = members+n; // Buckets by descending size
+    size_t* sizes = order+n; // Number of buckets of each size
+
+    for (size_t i = 0; i < n; ++i) starts[schema->fields[i].hash%n+1] += 1;
+    for (size_t bucket = 0; bucket < n; ++bucket) sizes[starts[bucket+1]] += 1;
+    for (size_t bucket = 0; bucket < n; ++bucket) starts[bucket+1] += starts[bucket];
+
+    // displacements is free until buckets are placed, it holds the fill position of each bucket
+    for (size_t i = 0; i < n; ++i) {
+        size_t bucket = schema->fields[i].hash%n;
+        members[starts[bucket]+schema->displacements[bucket]++] = i;
+    }
+
+    // sizes becomes the first position in order of each size, largest first
+    size_t position = 0;
+    for (size_t size = n+1; size-- > 0;) {
+        size_t count = sizes[size];
+        sizes[size] = position;
+        position += count;
+    }
+    for (size_t bucket = 0; bucket < n; ++bucket) {
+        order[sizes[starts[bucket+1]-starts[bucket]]++] = bucket;
+        schema->displacements[bucket] = 0;
+    }
+
+    schema->is_perfect = true;
+    for (size_t k = 0; k < n && schema->is_perfect; ++k) {
+        size_t bucket = order[k];
+        size_t first = starts[bucket];
+        size_t last = starts[bucket+1];
+        if (first == last) break; // Only empty buckets are left
+
+        bool is_placed = false;
+        for (size_t displacement = 0; displacement < 4096 && !is_placed; ++displacement) {
+            size_t placed = first;
+            while (placed < last) {
+                size_t i = members[placed];
+                size_t slot = coml__mix(schema->fields[i].hash, displacement)%slots_length;
+                if (schema->slots[slot] != 0) break;
+
+                schema->slots[slot] = i+1;
+                placed += 1;
+            }
+
+            is_placed = placed == last;
+            if (is_placed) {
+                schema->displacements[bucket] = displacement;
+            } else {
+                while (placed-- > first) {
+                    schema->slots[coml__mix(schema->fields[members[placed]].hash, displacement)%slots_length] = 0;
+                }
+            }
+        }
+
+        if (!is_placed) schema->is_perfect = false;
+    }
+
+    if (scratch != scratch_buffer) coml__free(&allocator, scratch, sizeof(size_t)*scratch_length);
+
+    schema->is_prepared = true;
+}
+
+// Checks that the dotted table path of a field names the table at path
+static bool coml__path_matches(const char* dotted, size_t length, const Coml__Path* path) {
+    if (path == NULL) return length == 0;
+
+    size_t name_length = strlen(path->name);
+    if (name_length > length || memcmp(dotted+length-name_length, path->name, name_length) != 0) return false;
+    if (name_length == length) return path->parent == NULL;
+    if (dotted[length-name_length-1] != '.') return false;
+
+    return coml__path_matches(dotted, length-name_length-1, path->parent);
+}
+
+typedef enum {
+    ComlBind__Unseen,
+    ComlBind__Bound,
+    ComlBind__Mistyped,
+} Coml__Bind_State;
+
+typedef struct {
+    Coml_Schema* schema;
+    char* out;
+    unsigned char* states;
+    size_t remaining;
+} Coml__Binder;
+
+static bool coml__bind_store(const Coml_Field* field, char* out, const Coml_KV* kv) {
+    switch (field->kind) {
+        case ComlBind_Int: {
+            if (kv->type != ComlType_Double) return false;
+
+            double value = *(double*)kv->value;
+            if (value != floor(value) || value < -2147483648.0 || value > 2147483647.0) return false;
+
+            int number = (int)value;
+            memcpy(out+field->offset, &number, sizeof(number));
+        } break;
+        case ComlBind_Float: {
+            if (kv->type != ComlType_Double) return false;
+
+            float number = (float)*(double*)kv->value;
+            memcpy(out+field->offset, &number, sizeof(number));
+        } break;
+        case ComlBind_Double: {
+            if (kv->type != ComlType_Double) return false;
+
+            memcpy(out+field->offset, kv->value, sizeof(double));
+        } break;
+        case ComlBind_Bool: {
+            if (kv->type != ComlType_Boolean) return false;
+
+            memcpy(out+field->offset, kv->value, sizeof(bool));
+        } break;
+        case ComlBind_String: {
+            if (kv->type != ComlType_String) return false;
+
+            const char* string = (const char*)kv->value;
+            memcpy(out+field->offset, &string, sizeof(string));
+        } break;
+    }
+
+    return true;
+}
+
+static void coml__bind_kv(Coml__Binder* binder, const Coml_KV* kv, const Coml__Path* path, size_t path_length, size_t hash) {
+    Coml_Schema* schema = binder->schema;
+    size_t n = schema->fields_length;
+    hash = coml__hash_continue(hash, kv->key, strlen(kv->key));
+
+    size_t first = 0;
+    size_t last = n;
+    if (schema->is_perfect) {
+        size_t slot = coml__mix(hash, schema->displacements[hash%n])%(n*2);
+        if (schema->slots[slot] == 0) return;
+
+        first = schema->slots[slot]-1;
+        last = first+1;
+    }
+
+    for (size_t i = first; i < last; ++i) {
+        const Coml_Field* field = &schema->fields[i];
+        if (field->hash != hash || binder->states[i] != ComlBind__Unseen) continue;
+        if (strcmp(field->key, kv->key) != 0) continue;
+        if (strlen(field->table) != path_length || !coml__path_matches(field->table, path_length, path)) continue;
+
+        binder->states[i] = coml__bind_store(field, binder->out, kv) ? ComlBind__Bound : ComlBind__Mistyped;
+        binder->remaining -= 1;
+    }
+}
+
+// Walks plain tables only, fields can't point into arrays of tables
+static void coml__bind_table(Coml__Binder* binder, const Coml_Table* table, const Coml__Path* path, size_t path_length, size_t path_hash) {
+    table = coml__body(table);
+    size_t hash = coml__hash_continue(path_hash, "", 1);
+    for (const Coml_KV* kv = table->items; kv != NULL && binder->remaining > 0; kv = kv->next) {
+        coml__bind_kv(binder, kv, path, path_length, hash);
+    }
+
+    for (const Coml_Table* child = table->tables; child != NULL && binder->remaining > 0; child = child->next) {
+        if (child->is_array) continue;
+
+        Coml__Path child_path = { child->name, path, false, 0 };
+        size_t child_hash = path_hash;
+        size_t child_length = strlen(child->name);
+        if (path != NULL) {
+            child_hash = coml__hash_continue(child_hash, ".", 1);
+            child_length += path_length+1;
+        }
+        child_hash = coml__hash_continue(child_hash, child->name, strlen(child->name));
+
+        coml__bind_table(binder, child, &child_path, child_length, child_hash);
+    }
+}
+
+static void coml__bind_default(const Coml_Field* field, char* out) {
+    switch (field->kind) {
+        case ComlBind_Int: {
+            int number = (int)field->default_number;
+            memcpy(out+field->offset, &number, sizeof(number));
+        } break;
+        case ComlBind_Float: {
+            float number = (float)field->default_number;
+            memcpy(out+field->offset, &number, sizeof(number));
+        } break;
+        case ComlBind_Double: {
+            memcpy(out+field->offset, &field->default_number, sizeof(double));
+        } break;
+        case ComlBind_Bool: {
+            memcpy(out+field->offset, &field->default_bool, sizeof(bool));
+        } break;
+        case ComlBind_String: {
+            memcpy(out+field->offset, &field->default_string, sizeof(const char*));
+        } break;
+    }
+}
+
+COMLDEF size_t coml_bind(Coml* coml, Coml_Schema* schema, void* out, Coml_Bind_Issue* issues, size_t max_issues) {
+    if (schema == NULL || out == NULL || schema->fields_length == 0) return 0;
+
+    coml_schema_prepare(schema);
+
+    Coml_Allocator allocator = coml != NULL ? coml->allocator : coml_default_allocator();
+    unsigned char states_buffer[64];
+    unsigned char* states = states_buffer;
+    if (schema->fields_length > sizeof(states_buffer)) {
+        states = (unsigned char*)coml__alloc(&allocator, schema->fields_length);
+        if (states == NULL) return (size_t)-1;
+    }
+    memset(states, ComlBind__Unseen, schema->fields_length);
+
+    if (coml != NULL) {
+        Coml__Binder binder = { schema, (char*)out, states, schema->fields_length };
+        coml__bind_table(&binder, coml->root, NULL, 0, COML__HASH_BASIS);
+    }
+
+    size_t issues_length = 0;
+    for (size_t i = 0; i < schema->fields_length; ++i) {
+        const Coml_Field* field = &schema->fields[i];
+        if (states[i] == ComlBind__Bound) continue;
+
+        coml__bind_default(field, (char*)out);
+        if (states[i] == ComlBind__Unseen && !field->is_required) continue;
+
+        if (issues != NULL && issues_length < max_issues) {
+            issues[issues_length].field = field;
+            issues[issues_length].kind = states[i] == ComlBind__Mistyped ? ComlBindIssue_Mistyped : ComlBindIssue_Missing;
+        }
+        issues_length += 1;
+    }
+
+    if (states != states_buffer) coml__free(&allocator, states, schema->fields_length);
+
+    return issues_length;
 }
 
-COMLDEF char* coml_get_value_string(Coml* coml, const char* table_name, const char* key_name) {
-    void* value = coml_get_value_raw(coml, ComlType_String, table_name, key_name);
-    if (value == NULL) return NULL;
+#define COML__IMAGE_MAGIC "COMLIMG"
+#define COML__IMAGE_VERSION 2
+#define COML__IMAGE_BYTE_ORDER 0x01020304u
 
-    return (char*)value;
+// Every record starts 8 byte aligned, offsets are from the start of the image
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order; // Images are only read on the kind of machine that wrote them
+    uint32_t size;
+    uint32_t root;
+} Coml__Image_Header;
+
+// Followed by the slots sorted by hash and the offsets of the child tables in the order coml_find_value_*
+// searches them, or by the offsets of the entries of an array of tables. Child tables come after their parent.
+typedef struct {
+    uint32_t slots_length;
+    uint32_t is_array;
+    uint32_t array_length;
+    uint32_t tables_length;
+} Coml__Image_Table;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t name; // A Coml__Image_String
+    uint32_t node; // A Coml__Image_Table or a Coml__Image_Value
+    uint32_t is_table;
+} Coml__Image_Slot;
+
+// Followed by the value: a double, a bool, a length and the characters of a string,
+// the doubles of a list or the offsets of the strings of a list
+typedef struct {
+    uint32_t type;
+    uint32_t list_length;
+} Coml__Image_Value;
+
+// Measures the image when data is NULL, the same calls then fill it in
+typedef struct {
+    unsigned char* data;
+    size_t length;
+    bool is_too_big;
+} Coml__Image_Writer;
+
+static uint32_t coml__image_reserve(Coml__Image_Writer* writer, size_t size, size_t align) {
+    size_t offset = (writer->length+align-1) & ~(align-1);
+    if (writer->data != NULL) memset(writer->data+writer->length, 0, offset+size-writer->length);
+
+    writer->length = offset+size;
+    if (writer->length > UINT32_MAX) writer->is_too_big = true;
+
+    return (uint32_t)offset;
 }
 
-COMLDEF bool coml_get_value_bool(Coml* coml, const char* table_name, const char* key_name) {
-    void* value = coml_get_value_raw(coml, ComlType_Boolean, table_name, key_name);
-    if (value == NULL) return false;
+static uint32_t coml__image_string(Coml__Image_Writer* writer, const char* string) {
+    size_t length = strlen(string);
+    uint32_t offset = coml__image_reserve(writer, sizeof(uint32_t)+length+1, sizeof(uint32_t));
+    if (writer->data != NULL) {
+        uint32_t stored_length = (uint32_t)length;
+        memcpy(writer->data+offset, &stored_length, sizeof(uint32_t));
+        memcpy(writer->data+offset+sizeof(uint32_t), string, length+1);
+    }
 
-    return *(bool*)value;
+    return offset;
 }
 
-COMLDEF double* coml_get_value_list_double(Coml* coml, const char* table_name, const char* key_name) {
-    void* value = coml_get_value_raw(coml, ComlType_ListDouble, table_name, key_name);
-    if (value == NULL) return NULL;
+static uint32_t coml__image_value(Coml__Image_Writer* writer, const Coml_KV* kv) {
+    size_t size = 0;
+    switch (kv->type) {
+        case ComlType_Double: size = sizeof(double); break;
+        case ComlType_String: size = sizeof(uint32_t)+strlen((char*)kv->value)+1; break;
+        case ComlType_Boolean: size = sizeof(bool); break;
+        case ComlType_ListDouble: size = sizeof(double)*kv->list_length; break;
+        case ComlType_ListString: size = sizeof(uint32_t)*kv->list_length; break;
+    }
 
-    return (double*)value;
+    uint32_t offset = coml__image_reserve(writer, sizeof(Coml__Image_Value)+size, 8);
+    unsigned char* payload = writer->data != NULL ? writer->data+offset+sizeof(Coml__Image_Value) : NULL;
+    if (writer->data != NULL) {
+        Coml__Image_Value* value = (Coml__Image_Value*)(writer->data+offset);
+        value->type = (uint32_t)kv->type;
+        value->list_length = (uint32_t)kv->list_length;
+
+        if (kv->type == ComlType_String) {
+            uint32_t length = (uint32_t)(size-sizeof(uint32_t)-1);
+            memcpy(payload, &length, sizeof(uint32_t));
+            memcpy(payload+sizeof(uint32_t), kv->value, length+1);
+        } else if (kv->type != ComlType_ListString && size > 0) {
+            memcpy(payload, kv->value, size);
+        }
+    }
+
+    if (kv->type == ComlType_ListString) {
+        for (size_t i = 0; i < kv->list_length; ++i) {
+            uint32_t string = coml__image_string(writer, ((char**)kv->value)[i]);
+            if (payload != NULL) memcpy(payload+sizeof(uint32_t)*i, &string, sizeof(uint32_t));
+        }
+    }
+
+    return offset;
 }
 
-COMLDEF char** coml_get_value_list_string(Coml* coml, const char* table_name, const char* key_name) {
-    void* value = coml_get_value_raw(coml, ComlType_ListString, table_name, key_name);
-    if (value == NULL) return NULL;
+static int coml__compare_image_slots(const void* a, const void* b) {
+    uint32_t hash_a = ((const Coml__Image_Slot*)a)->hash;
+    uint32_t hash_b = ((const Coml__Image_Slot*)b)->hash;
 
-    return (char**)value;
+    return (hash_a > hash_b)-(hash_a < hash_b);
 }
 
-COMLDEF void* coml_find_value_raw(Coml* coml, Coml_Type type, const char* key_name) {
-    Coml_KV* alone_kv = coml->items;
-    while (alone_kv != NULL) {
-        if (strcmp(alone_kv->key, key_name) == 0) {
-            if (alone_kv->type != type) return NULL;
-            return alone_kv->value;
+static uint32_t coml__image_table(Coml__Image_Writer* writer, const Coml_Table* table) {
+    if (table->is_array) {
+        uint32_t offset = coml__image_reserve(writer, sizeof(Coml__Image_Table)+sizeof(uint32_t)*table->array_length, 8);
+        if (writer->data != NULL) {
+            Coml__Image_Table* record = (Coml__Image_Table*)(writer->data+offset);
+            record->is_array = 1;
+            record->array_length = (uint32_t)table->array_length;
+        }
+
+        for (size_t i = 0; i < table->array_length; ++i) {
+            uint32_t entry = coml__image_table(writer, &table->array[i]);
+            if (writer->data != NULL) memcpy(writer->data+offset+sizeof(Coml__Image_Table)+sizeof(uint32_t)*i, &entry, sizeof(uint32_t));
         }
 
-        alone_kv = alone_kv->next;
+        return offset;
     }
 
-    Coml_Table* current_table = coml->tables;
-    while (current_table != NULL) {
-        Coml_KV* kv = current_table->items;
-        while (kv != NULL) {
-            if (strcmp(kv->key, key_name) == 0) {
-                if (alone_kv->type != type) return NULL;
-                return kv->value;
-            }
+    const Coml_Table* body = coml__body(table);
+    size_t tables_length = 0;
+    for (const Coml_Table* child = body->tables; child != NULL; child = child->next) ++tables_length;
+
+    uint32_t offset = coml__image_reserve(writer, sizeof(Coml__Image_Table)+sizeof(Coml__Image_Slot)*body->index.count+sizeof(uint32_t)*tables_length, 8);
+    Coml__Image_Slot* slots = writer->data != NULL ? (Coml__Image_Slot*)(writer->data+offset+sizeof(Coml__Image_Table)) : NULL;
+    uint32_t* tables = slots != NULL ? (uint32_t*)(slots+body->index.count) : NULL;
+
+    // Child tables first, in list order, so their offsets can be stored in that order too
+    size_t slots_length = 0;
+    for (const Coml_Table* child = body->tables; child != NULL; child = child->next) {
+        uint32_t name = coml__image_string(writer, child->name);
+        uint32_t node = coml__image_table(writer, child);
+        if (slots != NULL) {
+            Coml__Image_Slot slot = { (uint32_t)coml__hash(child->name, strlen(child->name)), name, node, 1 };
+            slots[slots_length] = slot;
+            tables[slots_length] = node;
+        }
+        ++slots_length;
+    }
 
-            kv = kv->next;
+    for (const Coml_KV* kv = body->items; kv != NULL; kv = kv->next) {
+        uint32_t name = coml__image_string(writer, kv->key);
+        uint32_t node = coml__image_value(writer, kv);
+        if (slots != NULL) {
+            Coml__Image_Slot slot = { (uint32_t)coml__hash(kv->key, strlen(kv->key)), name, node, 0 };
+            slots[slots_length] = slot;
         }
+        ++slots_length;
+    }
 
-        current_table = current_table->next;
+    if (writer->data != NULL) {
+        Coml__Image_Table* record = (Coml__Image_Table*)(writer->data+offset);
+        record->slots_length = (uint32_t)slots_length;
+        record->tables_length = (uint32_t)tables_length;
+        if (slots_length > 0) qsort(slots, slots_length, sizeof(Coml__Image_Slot), coml__compare_image_slots);
     }
 
-    return NULL;
+    return offset;
 }
 
-COMLDEF int coml_find_value_int(Coml* coml, const char* key_name) {
-    void* value = coml_find_value_raw(coml, ComlType_Double, key_name);
-    if (value == NULL) return 0;
+static bool coml__image_build(Coml* coml, Coml__Image_Writer* writer) {
+    uint32_t header = coml__image_reserve(writer, sizeof(Coml__Image_Header), 8);
+    uint32_t root = coml__image_table(writer, coml->root);
+    if (writer->is_too_big) return false;
+
+    if (writer->data != NULL) {
+        Coml__Image_Header* image_header = (Coml__Image_Header*)(writer->data+header);
+        memcpy(image_header->magic, COML__IMAGE_MAGIC, sizeof(image_header->magic));
+        image_header->version = COML__IMAGE_VERSION;
+        image_header->byte_order = COML__IMAGE_BYTE_ORDER;
+        image_header->size = (uint32_t)writer->length;
+        image_header->root = root;
+    }
 
-    return (int)*(double*)value;
+    return true;
 }
 
-COMLDEF float coml_find_value_float(Coml* coml, const char* key_name) {
-    void* value = coml_find_value_raw(coml, ComlType_Double, key_name);
-    if (value == NULL) return 0.f;
+COMLDEF size_t coml_image_size(Coml* coml) {
+    if (coml == NULL) return 0;
 
-    return (float)*(double*)value;
+    Coml__Image_Writer writer = { NULL, 0, false };
+    if (!coml__image_build(coml, &writer)) return 0;
+
+    return writer.length;
 }
 
-COMLDEF char* coml_find_value_string(Coml* coml, const char* key_name) {
-    void* value = coml_find_value_raw(coml, ComlType_String, key_name);
-    if (value == NULL) return NULL;
+COMLDEF bool coml_image_write(Coml* coml, void* buffer, size_t size) {
+    if (coml == NULL || buffer == NULL || (uintptr_t)buffer%8 != 0) return false;
 
-    return (char*)value;
+    size_t image_size = coml_image_size(coml);
+    if (image_size == 0 || size < image_size) return false;
+
+    Coml__Image_Writer writer = { (unsigned char*)buffer, 0, false };
+    return coml__image_build(coml, &writer);
 }
 
-COMLDEF bool coml_find_value_bool(Coml* coml, const char* key_name) {
-    void* value = coml_find_value_raw(coml, ComlType_Boolean, key_name);
-    if (value == NULL) return false;
+COMLDEF bool coml_write_image_file(Coml* coml, const char* path) {
+    if (coml == NULL || path == NULL || strcmp(path, "") == 0) return false;
 
-    return *(bool*)value;
+    size_t size = coml_image_size(coml);
+    if (size == 0) return false;
+
+    void* buffer = coml__alloc(&coml->allocator, size);
+    if (buffer == NULL) return false;
+
+    bool res = coml_image_write(coml, buffer, size);
+    FILE* file = res ? fopen(path, "wb") : NULL;
+    if (file != NULL) {
+        res = fwrite(buffer, 1, size, file) == size;
+        res = fclose(file) == 0 && res;
+    } else {
+        res = false;
+    }
+
+    coml__free(&coml->allocator, buffer, size);
+
+    return res;
 }
 
-COMLDEF double* coml_find_value_list_double(Coml* coml, const char* key_name) {
-    void* value = coml_find_value_raw(coml, ComlType_ListDouble, key_name);
-    if (value == NULL) return NULL;
+COMLDEF bool coml_image_open(Coml_Image* image, const void* data, size_t size) {
+    if (image == NULL) return false;
+    memset(image, 0, sizeof(Coml_Image));
+    if (data == NULL || size < sizeof(Coml__Image_Header) || (uintptr_t)data%8 != 0) return false;
+
+    const Coml__Image_Header* header = (const Coml__Image_Header*)data;
+    if (memcmp(header->magic, COML__IMAGE_MAGIC, sizeof(header->magic)) != 0) return false;
+    if (header->version != COML__IMAGE_VERSION || header->byte_order != COML__IMAGE_BYTE_ORDER) return false;
+    if (header->size > size || header->size < sizeof(Coml__Image_Header)) return false;
+
+    image->data = (const unsigned char*)data;
+    image->size = header->size;
+    image->root = header->root;
+    if (header->root%8 != 0 || header->root > image->size-sizeof(Coml__Image_Table)) {
+        memset(image, 0, sizeof(Coml_Image));
+        return false;
+    }
 
-    return (double*)value;
+    return true;
 }
 
-COMLDEF char** coml_find_value_list_string(Coml* coml, const char* key_name) {
-    void* value = coml_find_value_raw(coml, ComlType_ListString, key_name);
-    if (value == NULL) return NULL;
+#ifdef COML_HAS_MMAP
+COMLDEF bool coml_image_map(Coml_Image* image, const char* path) {
+    if (image == NULL) return false;
+    memset(image, 0, sizeof(Coml_Image));
 
-    return (char**)value;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = (size_t)info.st_size;
+    void* data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    if (!coml_image_open(image, data, size)) {
+        munmap(data, size);
+        return false;
+    }
+    image->mapped_size = size;
+
+    return true;
 }
 
-COMLDEF Coml_KV* coml_get_kv(Coml* coml, const char* table_name, const char* key_name) {
-    if (table_name == NULL) {
-        Coml_KV* alone_kv = coml->items;
-        while (alone_kv != NULL) {
-            if (strcmp(alone_kv->key, key_name) == 0) {
-                return alone_kv;
-            }
+COMLDEF void coml_image_unmap(Coml_Image* image) {
+    if (image == NULL || image->mapped_size == 0) return;
 
-            alone_kv = alone_kv->next;
-        }
+    munmap((void*)image->data, image->mapped_size);
+    memset(image, 0, sizeof(Coml_Image));
+}
+#endif
+
+// NULL if the record doesn't fit in the image
+static const void* coml__image_at(const Coml_Image* image, uint32_t offset, size_t size) {
+    if (image->data == NULL || offset > image->size || size > image->size-offset) return NULL;
+
+    return image->data+offset;
+}
+
+static const Coml__Image_Slot* coml__image_find(const Coml_Image* image, uint32_t table, const char* key, size_t length) {
+    const Coml__Image_Table* record = (const Coml__Image_Table*)coml__image_at(image, table, sizeof(Coml__Image_Table));
+    if (record == NULL || record->is_array) return NULL;
+
+    const Coml__Image_Slot* slots = (const Coml__Image_Slot*)coml__image_at(image, table+(uint32_t)sizeof(Coml__Image_Table), sizeof(Coml__Image_Slot)*record->slots_length);
+    if (slots == NULL) return NULL;
+
+    uint32_t hash = (uint32_t)coml__hash(key, length);
+    size_t low = 0;
+    size_t high = record->slots_length;
+    while (low < high) {
+        size_t middle = low+(high-low)/2;
+        if (slots[middle].hash < hash) low = middle+1;
+        else high = middle;
     }
 
-    Coml_Table* current_table = coml->tables;
-    while (current_table != NULL) {
-        if (table_name != NULL && strcmp(current_table->name, table_name) == 0) {
-            Coml_KV* kv = current_table->items;
-            while (kv != NULL) {
-                if (strcmp(kv->key, key_name) == 0) return kv;
+    for (size_t i = low; i < record->slots_length && slots[i].hash == hash; ++i) {
+        const uint32_t* name_length = (const uint32_t*)coml__image_at(image, slots[i].name, sizeof(uint32_t));
+        if (name_length == NULL || *name_length != length) continue;
 
-                kv = kv->next;
-            }
-        } else {
-            Coml_KV* kv = current_table->items;
-            while (kv != NULL) {
-                if (strcmp(kv->key, key_name) == 0) return kv;
+        const char* name = (const char*)coml__image_at(image, slots[i].name+(uint32_t)sizeof(uint32_t), length+1);
+        if (name != NULL && memcmp(name, key, length) == 0) return &slots[i];
+    }
 
-                kv = kv->next;
-            }
+    return NULL;
+}
+
+// Like coml__lookup, NULL if a segment is missing
+static const Coml__Image_Slot* coml__image_lookup(const Coml_Image* image, uint32_t table, const char* path) {
+    size_t end = strlen(path);
+    size_t pos = 0;
+    const Coml__Image_Slot* slot = NULL;
+
+    while (pos < end) {
+        if (slot != NULL) {
+            if (!slot->is_table) return NULL;
+            table = slot->node;
         }
-    
-        current_table = current_table->next;
+
+        size_t segment_start = 0;
+        size_t segment_length = 0;
+        if (!coml__next_key_segment(path, &pos, end, &segment_start, &segment_length)) return NULL;
+
+        slot = coml__image_find(image, table, path+segment_start, segment_length);
+        if (slot == NULL) return NULL;
     }
 
-    return NULL;
+    return slot;
 }
 
-COMLDEF bool coml_set_int(Coml* coml, int value, const char* table_name, const char* key_name) {
-    Coml_KV* kv = coml_get_kv(coml, table_name, key_name);
-    if (kv == NULL || kv->type != ComlType_Double) return false;
+static const Coml__Image_Value* coml__image_get_value(const Coml_Image* image, const char* table_name, const char* key_name) {
+    if (image == NULL || image->data == NULL || key_name == NULL) return NULL;
 
-    kv->value = realloc(kv->value, sizeof(double));
-    *((double*)kv->value) = (double)value;
+    uint32_t table = (uint32_t)image->root;
+    if (table_name != NULL && table_name[0] != '\0') {
+        const Coml__Image_Slot* slot = coml__image_lookup(image, table, table_name);
+        if (slot == NULL || !slot->is_table) return NULL;
+        table = slot->node;
+    }
 
-    return true;
+    const Coml__Image_Slot* slot = coml__image_lookup(image, table, key_name);
+    if (slot == NULL || slot->is_table) return NULL;
+
+    return (const Coml__Image_Value*)coml__image_at(image, slot->node, sizeof(Coml__Image_Value));
 }
 
-COMLDEF bool coml_set_float(Coml* coml, float value, const char* table_name, const char* key_name) {
-    Coml_KV* kv = coml_get_kv(coml, table_name, key_name);
-    if (kv == NULL || kv->type != ComlType_Double) return false;
+// The value after value, NULL if it isn't of type
+static const void* coml__image_payload(const Coml_Image* image, const Coml__Image_Value* value, Coml_Type type) {
+    if (value == NULL || value->type != (uint32_t)type) return NULL;
+
+    uint32_t offset = (uint32_t)((const unsigned char*)value-image->data)+(uint32_t)sizeof(Coml__Image_Value);
+    size_t size = 0;
+    switch (type) {
+        case ComlType_Double: size = sizeof(double); break;
+        case ComlType_String: size = sizeof(uint32_t); break;
+        case ComlType_Boolean: size = sizeof(bool); break;
+        case ComlType_ListDouble: size = sizeof(double)*value->list_length; break;
+        case ComlType_ListString: size = sizeof(uint32_t)*value->list_length; break;
+    }
 
-    kv->value = realloc(kv->value, sizeof(float));
-    *((double*)kv->value) = (double)value;
+    const unsigned char* payload = (const unsigned char*)coml__image_at(image, offset, size);
+    if (payload == NULL) return NULL;
 
-    return true;
+    if (type == ComlType_String) {
+        const uint32_t* length = (const uint32_t*)payload;
+        return coml__image_at(image, offset+(uint32_t)sizeof(uint32_t), (size_t)*length+1);
+    }
+
+    return payload;
 }
 
-COMLDEF bool coml_set_string(Coml* coml, char* value, const char* table_name, const char* key_name) {
-    Coml_KV* kv = coml_get_kv(coml, table_name, key_name);
-    if (kv == NULL || kv->type != ComlType_String) return false;
+static size_t coml__image_list_length(const Coml__Image_Value* value) {
+    if (value == NULL || (value->type != ComlType_ListDouble && value->type != ComlType_ListString)) return 0;
+
+    return value->list_length;
+}
 
-    free(kv->value);
-    char* temp_buf = strdup(value);
-    kv->value = strdup(temp_buf);
-    free(temp_buf);
+static const char* coml__image_list_string_at(const Coml_Image* image, const Coml__Image_Value* value, size_t index) {
+    const uint32_t* strings = (const uint32_t*)coml__image_payload(image, value, ComlType_ListString);
+    if (strings == NULL || index >= value->list_length) return NULL;
 
-    return true;
+    const uint32_t* length = (const uint32_t*)coml__image_at(image, strings[index], sizeof(uint32_t));
+    if (length == NULL) return NULL;
+
+    return (const char*)coml__image_at(image, strings[index]+(uint32_t)sizeof(uint32_t), (size_t)*length+1);
 }
 
-COMLDEF bool coml_set_bool(Coml* coml, bool value, const char* table_name, const char* key_name) {
-    Coml_KV* kv = coml_get_kv(coml, table_name, key_name);
-    if (kv == NULL || kv->type != ComlType_Boolean) return false;
+COMLDEF const void* coml_image_get_value_raw(const Coml_Image* image, Coml_Type type, const char* table_name, const char* key_name) {
+    return coml__image_payload(image, coml__image_get_value(image, table_name, key_name), type);
+}
 
-    kv->value = realloc(kv->value, sizeof(bool));
-    *((bool*)kv->value) = value;
+COMLDEF int coml_image_get_value_int(const Coml_Image* image, const char* table_name, const char* key_name) {
+    const void* value = coml_image_get_value_raw(image, ComlType_Double, table_name, key_name);
+    if (value == NULL) return 0;
 
-    return true;
+    return (int)*(const double*)value;
 }
 
-COMLDEF bool coml_set_list_double(Coml* coml, double* value, size_t length, const char* table_name, const char* key_name) {
-    Coml_KV* kv = coml_get_kv(coml, table_name, key_name);
-    if (kv == NULL || kv->type != ComlType_ListDouble) return false;
+COMLDEF float coml_image_get_value_float(const Coml_Image* image, const char* table_name, const char* key_name) {
+    const void* value = coml_image_get_value_raw(image, ComlType_Double, table_name, key_name);
+    if (value == NULL) return 0.f;
 
-    kv->value = realloc(kv->value, sizeof(double)*length);
-    for (size_t i = 0; i < length; i++) {
-        ((double*)kv->value)[i] = value[i];
-    }
-    kv->list_length = length;
+    return (float)*(const double*)value;
+}
 
-    return true;
+COMLDEF const char* coml_image_get_value_string(const Coml_Image* image, const char* table_name, const char* key_name) {
+    return (const char*)coml_image_get_value_raw(image, ComlType_String, table_name, key_name);
 }
 
-COMLDEF bool coml_set_list_string(Coml* coml, char** value, size_t length, const char* table_name, const char* key_name) {
-    Coml_KV* kv = coml_get_kv(coml, table_name, key_name);
-    if (kv == NULL || kv->type != ComlType_ListString) return false;
+COMLDEF bool coml_image_get_value_bool(const Coml_Image* image, const char* table_name, const char* key_name) {
+    const void* value = coml_image_get_value_raw(image, ComlType_Boolean, table_name, key_name);
+    if (value == NULL) return false;
+
+    return *(const bool*)value;
+}
+
+COMLDEF const double* coml_image_get_value_list_double(const Coml_Image* image, const char* table_name, const char* key_name) {
+    return (const double*)coml_image_get_value_raw(image, ComlType_ListDouble, table_name, key_name);
+}
+
+COMLDEF size_t coml_image_get_list_length(const Coml_Image* image, const char* table_name, const char* key_name) {
+    return coml__image_list_length(coml__image_get_value(image, table_name, key_name));
+}
+
+COMLDEF const char* coml_image_get_list_string_at(const Coml_Image* image, const char* table_name, const char* key_name, size_t index) {
+    return coml__image_list_string_at(image, coml__image_get_value(image, table_name, key_name), index);
+}
+
+// Depth-first search in the same order as coml__find_kv. Child tables are always after their
+// parent, so anything else is skipped and a broken image can't make the search loop.
+static const Coml__Image_Value* coml__image_find_value(const Coml_Image* image, uint32_t table, const char* key, size_t length) {
+    const Coml__Image_Table* record = (const Coml__Image_Table*)coml__image_at(image, table, sizeof(Coml__Image_Table));
+    if (record == NULL) return NULL;
 
-    for (size_t i = 0; i < kv->list_length; ++i) {
-        free(((char**)kv->value)[i]);
+    size_t offset = (size_t)table+sizeof(Coml__Image_Table);
+    size_t tables_length = record->array_length;
+    if (!record->is_array) {
+        const Coml__Image_Slot* slot = coml__image_find(image, table, key, length);
+        if (slot != NULL && !slot->is_table) return (const Coml__Image_Value*)coml__image_at(image, slot->node, sizeof(Coml__Image_Value));
+
+        offset += sizeof(Coml__Image_Slot)*record->slots_length;
+        tables_length = record->tables_length;
     }
-    free(kv->value);
+    if (offset > image->size) return NULL;
 
-    kv->value = realloc(NULL, sizeof(char*)*length+length);
-    for (size_t i = 0; i < length; i++) {
-        ((char**)kv->value)[i] = strdup(value[i]);
+    const uint32_t* tables = (const uint32_t*)coml__image_at(image, (uint32_t)offset, sizeof(uint32_t)*tables_length);
+    if (tables == NULL) return NULL;
+
+    for (size_t i = 0; i < tables_length; ++i) {
+        if (tables[i] <= table || tables[i]%8 != 0) continue;
+
+        const Coml__Image_Value* value = coml__image_find_value(image, tables[i], key, length);
+        if (value != NULL) return value;
     }
-    kv->list_length = length;
 
-    return true;
+    return NULL;
 }
 
-COMLDEF void coml_print_kv(const Coml_KV* kv, bool indent) {
-    if (kv == NULL) return;
-    
-    coml_print_kv(kv->next, indent);
+static const Coml__Image_Value* coml__image_find_key(const Coml_Image* image, const char* key_name) {
+    if (image == NULL || image->data == NULL || key_name == NULL) return NULL;
 
-    const char* indent_str = indent ? "    " : "";
-    const char* indent_str2 = indent ? "\t" : "    ";
+    return coml__image_find_value(image, (uint32_t)image->root, key_name, strlen(key_name));
+}
 
-    switch (kv->type) {
-        case ComlType_Double:
-            if (floor(*(double*)kv->value) == *(double*)kv->value) {
-                printf("%s%s: %i\n", indent_str, kv->key, (int)*(double*)kv->value);
-            } else {
-                printf("%s%s: %.10lf\n", indent_str, kv->key, *(double*)kv->value);
-            }
-            break;
-        case ComlType_String:
-            printf("%s%s: %s\n", indent_str, kv->key, (char*)kv->value);
-            break;
-        case ComlType_Boolean:
-            printf("%s%s: %s\n", indent_str, kv->key, *(bool*)kv->value ? "true" : "false");
-            break;
-        case ComlType_ListDouble:
-            printf("%s%s:\n", indent_str, kv->key);
-            for (size_t i = 0; i < kv->list_length; ++i) {
-                if (floor(((double*)kv->value)[i]) == ((double*)kv->value)[i]) {
-                    printf("%s%zu - %i\n", indent_str2, i, (int)((double*)kv->value)[i]);
-                } else {
-                    printf("%s%zu - %.10lf\n", indent_str2, i, ((double*)kv->value)[i]);
-                }
-            }
-            break;
-        case ComlType_ListString:
-            printf("%s%s:\n", indent_str, kv->key);
-            for (size_t i = 0; i < kv->list_length; ++i) {
-                printf("%s%zu - %s\n", indent_str2, i, ((char**)kv->value)[i]);
-            }
-            break;
-        default:
-            printf("%s%s: NULL (default)\n", indent_str, kv->key);
-            break;
-    }
+COMLDEF const void* coml_image_find_value_raw(const Coml_Image* image, Coml_Type type, const char* key_name) {
+    return coml__image_payload(image, coml__image_find_key(image, key_name), type);
 }
 
-COMLDEF void coml_print_table(const Coml_Table* table) {
-    if (table == NULL) return;
-    
-    coml_print_table(table->next);
-    
-    printf("Table: %s\n", table->name);
-    
-    Coml_KV* current_kv = table->items;
-    coml_print_kv(current_kv, true);
+COMLDEF int coml_image_find_value_int(const Coml_Image* image, const char* key_name) {
+    const void* value = coml_image_find_value_raw(image, ComlType_Double, key_name);
+    if (value == NULL) return 0;
+
+    return (int)*(const double*)value;
 }
 
-COMLDEF void coml_print(const Coml* coml) {
-    Coml_KV* current_item = coml->items;
-    coml_print_kv(current_item, false);
+COMLDEF float coml_image_find_value_float(const Coml_Image* image, const char* key_name) {
+    const void* value = coml_image_find_value_raw(image, ComlType_Double, key_name);
+    if (value == NULL) return 0.f;
 
-    printf("\n");
+    return (float)*(const double*)value;
+}
 
-    Coml_Table* current_table = coml->tables;
-    coml_print_table(current_table);
+COMLDEF const char* coml_image_find_value_string(const Coml_Image* image, const char* key_name) {
+    return (const char*)coml_image_find_value_raw(image, ComlType_String, key_name);
 }
 
-COMLDEF char* coml_trim(char* input) {
-    char* iter = input;
-    char* out = (char*)malloc(strlen(input)+1);
-    bool is_in_string = false;
-    
-    if (out != NULL) {
-        char* out_iter = out;
+COMLDEF bool coml_image_find_value_bool(const Coml_Image* image, const char* key_name) {
+    const void* value = coml_image_find_value_raw(image, ComlType_Boolean, key_name);
+    if (value == NULL) return false;
 
-        while (*iter != '\0') {
-            if (*iter == '"' || *iter == '\'') {
-                is_in_string = !is_in_string;
-            }
+    return *(const bool*)value;
+}
 
-            if (is_in_string) {
-                *out_iter = *iter;
-                ++out_iter;
-            } else {
-                if (*iter != 0x09 && *iter != 0x20) {
-                    *out_iter = *iter;
-                    ++out_iter;
-                }
-            }
-            ++iter;
-        }
+COMLDEF const double* coml_image_find_value_list_double(const Coml_Image* image, const char* key_name) {
+    return (const double*)coml_image_find_value_raw(image, ComlType_ListDouble, key_name);
+}
 
-        *out_iter = '\0';
-    }
-    
-    return out;
+COMLDEF size_t coml_image_find_list_length(const Coml_Image* image, const char* key_name) {
+    return coml__image_list_length(coml__image_find_key(image, key_name));
 }
 
-COMLDEF char** coml_split(char* input, char* delim) {
-    char* temp_input = strdup(input);
-    char** result = NULL;
-    size_t count = 0;
-    char* token = strtok(temp_input, delim);
-    
-    while (token) {
-        result = (char**)realloc(result, (count+1)*sizeof(char*));
-        result[count++] = strdup(token);
-        token = strtok(NULL, delim);
-    }
-    
-    free(temp_input);
-    result = (char**)realloc(result, (count+1)*sizeof(char*));
-    result[count] = NULL;
-    
-    return result;
+COMLDEF const char* coml_image_find_list_string_at(const Coml_Image* image, const char* key_name, size_t index) {
+    return coml__image_list_string_at(image, coml__image_find_key(image, key_name), index);
+}
+
+// The offsets of the entries of the array of tables at path, NULL if there is none
+static const uint32_t* coml__image_array(const Coml_Image* image, const char* path, size_t* length) {
+    if (image == NULL || image->data == NULL || path == NULL) return NULL;
+
+    const Coml__Image_Slot* slot = coml__image_lookup(image, (uint32_t)image->root, path);
+    if (slot == NULL || !slot->is_table) return NULL;
+
+    const Coml__Image_Table* record = (const Coml__Image_Table*)coml__image_at(image, slot->node, sizeof(Coml__Image_Table));
+    if (record == NULL || !record->is_array) return NULL;
+
+    *length = record->array_length;
+    return (const uint32_t*)coml__image_at(image, slot->node+(uint32_t)sizeof(Coml__Image_Table), sizeof(uint32_t)*record->array_length);
 }
 
-COMLDEF size_t coml_split_length(char **split) {
+COMLDEF size_t coml_image_table_array_len(const Coml_Image* image, const char* path) {
     size_t length = 0;
-    while (split[length] != NULL) length++;
+    if (coml__image_array(image, path, &length) == NULL) return 0;
 
     return length;
 }
 
+COMLDEF bool coml_image_table_array_at(const Coml_Image* image, const char* path, size_t index, Coml_Image* entry) {
+    size_t length = 0;
+    const uint32_t* entries = coml__image_array(image, path, &length);
+    if (entry == NULL || entries == NULL || index >= length) return false;
+
+    uint32_t root = entries[index];
+    if (root%8 != 0 || coml__image_at(image, root, sizeof(Coml__Image_Table)) == NULL) return false;
+
+    *entry = *image;
+    entry->mapped_size = 0;
+    entry->root = root;
+
+    return true;
+}
 #endif // COML_IMPLEMENTATION
 
 // MIT License
@@ -905,5 +5743,5 @@ COMLDEF size_t coml_split_length(char **split) {
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
-// TODO: Support multi-line (strings, lists, objects, etc.)
+// TODO: Support dates, times, inline tables and nested lists
 
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COML_IMPLEMENTATION
+#include "coml.h"
+
+static char* read_file(const char* path, size_t* length) {
+    FILE* file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    size_t capacity = 1 << 16;
+    char* content = malloc(capacity);
+    *length = 0;
+
+    while (content != NULL) {
+        *length += fread(content+*length, 1, capacity-*length, file);
+        if (*length < capacity) break;
+
+        capacity *= 2;
+        char* new_content = realloc(content, capacity);
+        if (new_content == NULL) free(content);
+        content = new_content;
+    }
+
+    if (file != stdin) fclose(file);
+
+    return content;
+}
+
+static bool write_failed(Coml_Error* error) {
+    error->code = ComlError_WriteFailed;
+    error->offset = 0;
+    error->line = 0;
+    error->column = 0;
+    error->message = "could not write the output";
+    return false;
+}
+
+// Streams into a temporary file first, a document with a table split over several places
+// fails to stream and goes through a Coml instead, which is also used without a temporary file
+static bool toml_to_json(const char* content, size_t length, Coml_Error* error) {
+    FILE* output = tmpfile();
+    if (output != NULL) {
+        bool res = coml_toml_to_json(content, length, output, NULL, error);
+        if (res) {
+            char buffer[1 << 16];
+            size_t read = 0;
+            rewind(output);
+            while (res && (read = fread(buffer, 1, sizeof(buffer), output)) > 0) res = fwrite(buffer, 1, read, stdout) == read;
+            if (!res || ferror(output)) res = write_failed(error);
+        }
+
+        fclose(output);
+        if (res || error->code != ComlError_Unsupported) return res;
+    }
+
+    Coml* coml = coml_parse_ex(content, length, NULL, error);
+    if (coml == NULL) return false;
+
+    bool res = coml_write_json(coml, stdout);
+    coml_free(coml);
+    if (!res) write_failed(error);
+
+    return res;
+}
+
+int main(int argc, char** argv) {
+    bool is_reverse = argc == 3 && strcmp(argv[1], "-r") == 0;
+    if (argc != 2 && !is_reverse) {
+        fprintf(stderr, "Usage: %s [-r] <file>\n", argv[0]);
+        fprintf(stderr, "Converts TOML to JSON, or JSON to TOML with -r. Use - to read from stdin.\n");
+        return 1;
+    }
+
+    const char* path = argv[argc-1];
+    size_t length = 0;
+    char* content = read_file(path, &length);
+    if (content == NULL) {
+        fprintf(stderr, "%s: could not read file\n", path);
+        return 1;
+    }
+
+    Coml_Error error;
+    int status = 0;
+    if (is_reverse) {
+        Coml* coml = coml_from_json(content, length, NULL, &error);
+        if (coml != NULL) {
+            coml_format_kv(stdout, coml->root->items);
+            printf("\n");
+            coml_format_table(stdout, coml->root->tables);
+            coml_free(coml);
+        } else {
+            status = 1;
+        }
+    } else if (!toml_to_json(content, length, &error)) {
+        status = 1;
+    }
+
+    // Output is buffered, so a full disk or a closed pipe may only show up here
+    if (status == 0 && (fflush(stdout) != 0 || ferror(stdout))) {
+        write_failed(&error);
+        status = 1;
+    }
+
+    if (status != 0) fprintf(stderr, "%s:%zu:%zu: %s\n", path, error.line, error.column, error.message);
+
+    free(content);
+
+    return status;
+}
@@ -22,9 +22,10 @@ int main(void) {
         "nums = [ 123, 321 ]\n"
     };
 
-    Coml* coml = coml_parse(data, false);
+    Coml_Error error;
+    Coml* coml = coml_parse_ex(data, sizeof(data)-1, NULL, &error);
     if (coml == NULL) {
-        fprintf(stderr, "Something went wrong...\n");
+        fprintf(stderr, "%zu:%zu: %s\n", error.line, error.column, error.message);
         return 1;
     }
     
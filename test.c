@@ -0,0 +1,566 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COML_IMPLEMENTATION
+#include "coml.h"
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures += 1; \
+        } \
+    } while (0)
+
+static size_t count_items(const Coml_Table* table) {
+    size_t count = 0;
+    for (const Coml_KV* kv = table->items; kv != NULL; kv = kv->next) count += 1;
+    return count;
+}
+
+static size_t read_file(const char* path, char* buffer, size_t size) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return 0;
+
+    size_t length = fread(buffer, 1, size-1, file);
+    buffer[length] = '\0';
+    fclose(file);
+
+    return length;
+}
+
+static void test_shared_tables(void) {
+    const char data[] =
+        "[server]\n"
+        "port = 8080\n"
+        "host = \"localhost\"\n"
+        "[client]\n"
+        "retries = 3\n"
+        "[[backend]]\n"
+        "name = \"a\"\n"
+        "[[backend]]\n"
+        "name = \"b\"\n";
+
+    Coml* coml = coml_parse_ex(data, sizeof(data)-1, NULL, NULL);
+    CHECK(coml != NULL);
+    if (coml == NULL) return;
+
+    Coml* clone = coml_clone(coml);
+    CHECK(clone != NULL);
+    if (clone == NULL) {
+        coml_free(coml);
+        return;
+    }
+
+    // Only the root and server get their own items, client and backend stay shared
+    CHECK(coml_set_int(clone, 9090, "server", "port"));
+
+    const Coml_Table* client = coml_get_table(clone, "client");
+    CHECK(client != NULL && count_items(client) == 1);
+
+    const Coml_Table* backends = coml_get_table(clone, "backend");
+    CHECK(coml_table_array_len(backends) == 2);
+    for (size_t i = 0; i < coml_table_array_len(backends); ++i) {
+        CHECK(count_items(coml_table_array_at(backends, i)) == 1);
+    }
+
+    CHECK(count_items(coml_get_table(clone, NULL)) == 0);
+    CHECK(coml_get_value_int(clone, "server", "port") == 9090);
+    CHECK(coml_get_value_int(coml, "server", "port") == 8080);
+
+    Coml_Query query;
+    size_t matches = 0;
+    CHECK(coml_query(clone, "client", &query));
+    while (coml_query_next(&query)) {
+        CHECK(query.table != NULL && count_items(query.table) == 1);
+        matches += 1;
+    }
+    coml_query_free(&query);
+    CHECK(matches == 1);
+
+    // Edits through a clone stay in the clone
+    Coml_Allocator allocator = coml_default_allocator();
+    CHECK(coml_insert_kv(&allocator, coml_edit_table(clone, "client"), "x", "1") != NULL);
+    CHECK(coml_insert_kv(&allocator, coml_edit_table_array_at(clone, "backend", 0), "x", "2") != NULL);
+    CHECK(coml_insert_table(&allocator, coml_edit_table(clone, NULL), "extra") != NULL);
+
+    Coml_KV* retries = coml_get_kv(clone, "client", "retries");
+    CHECK(retries != NULL && retries->type == ComlType_Double);
+    if (retries != NULL) *(double*)retries->value = 5;
+
+    CHECK(coml_get_path(clone, "client.x") != NULL);
+    CHECK(coml_get_value_int(clone, "client", "retries") == 5);
+    CHECK(count_items(coml_table_array_at(coml_get_table(clone, "backend"), 0)) == 2);
+    CHECK(coml_get_table(clone, "extra") != NULL);
+
+    CHECK(coml_get_path(coml, "client.x") == NULL);
+    CHECK(coml_get_value_int(coml, "client", "retries") == 3);
+    CHECK(count_items(coml_table_array_at(coml_get_table(coml, "backend"), 0)) == 1);
+    CHECK(coml_get_table(coml, "extra") == NULL);
+
+    // Merging values that are already there leaves the table shared
+    const char same[] = "[client]\nretries = 3\n[server]\nport = 1\n";
+    Coml* layer = coml_parse_ex(same, sizeof(same)-1, NULL, NULL);
+    Coml* config = coml_clone(coml);
+    CHECK(layer != NULL && config != NULL);
+    CHECK(coml_merge(config, layer, ComlMerge_Overwrite));
+    CHECK(coml_get_table(config, "client") == coml_get_table(coml, "client"));
+    CHECK(coml_get_table(config, "server") != coml_get_table(coml, "server"));
+    CHECK(coml_get_value_int(config, "server", "port") == 1);
+    coml_free(config);
+    coml_free(layer);
+
+    coml_free(clone);
+    coml_free(coml);
+}
+
+static void test_spliced_write(void) {
+    const char* path = "test_write.toml";
+    char written[1024];
+    Coml_Options options = { NULL, true, NULL };
+
+    const char data[] =
+        "# kept\n"
+        "[server]\n"
+        "port = 8080 # also kept\n";
+
+    Coml* coml = coml_parse_ex(data, sizeof(data)-1, &options, NULL);
+    CHECK(coml != NULL);
+    if (coml == NULL) return;
+
+    CHECK(coml_add_table(coml, "empty") != NULL);
+    CHECK(coml_add_table(coml, "server.tls") != NULL);
+    CHECK(coml_write_file(coml, path));
+    read_file(path, written, sizeof(written));
+    CHECK(strcmp(written, "# kept\n[server]\nport = 8080 # also kept\n\n[server.tls]\n\n[empty]\n") == 0);
+    coml_free(coml);
+
+    // Both writers agree on the tables that exist
+    coml = coml_from_file(path);
+    CHECK(coml != NULL && coml_get_table(coml, "empty") != NULL && coml_get_table(coml, "server.tls") != NULL);
+    coml_free(coml);
+
+    const char crlf[] =
+        "a = 1\r\n"
+        "[t]\r\n"
+        "b = 2\r\n";
+
+    coml = coml_parse_ex(crlf, sizeof(crlf)-1, &options, NULL);
+    CHECK(coml != NULL);
+    if (coml == NULL) return;
+
+    CHECK(coml_add_int(coml, 3, "t", "c"));
+    CHECK(coml_add_table(coml, "u") != NULL);
+    CHECK(coml_write_file(coml, path));
+    read_file(path, written, sizeof(written));
+    CHECK(strcmp(written, "a = 1\r\n[t]\r\nb = 2\r\nc = 3\r\n\r\n[u]\r\n") == 0);
+    coml_free(coml);
+
+    // A new table in an entry that isn't the last one goes before the next entry
+    const char entries[] =
+        "[[a]]\n"
+        "n = 1\n"
+        "[[a]]\n"
+        "n = 2\n";
+
+    coml = coml_parse_ex(entries, sizeof(entries)-1, &options, NULL);
+    CHECK(coml != NULL);
+    if (coml == NULL) return;
+
+    Coml_Allocator allocator = coml_default_allocator();
+    CHECK(coml_insert_table(&allocator, coml_edit_table_array_at(coml, "a", 0), "sub") != NULL);
+    CHECK(coml_write_file(coml, path));
+    read_file(path, written, sizeof(written));
+    CHECK(strcmp(written, "[[a]]\nn = 1\n\n[a.sub]\n[[a]]\nn = 2\n") == 0);
+    coml_free(coml);
+
+    coml = coml_from_file(path);
+    CHECK(coml != NULL);
+    if (coml == NULL) return;
+
+    const Coml_Table* a = coml_get_table(coml, "a");
+    CHECK(coml_table_array_len(a) == 2);
+    CHECK(coml_table_array_at(a, 0)->tables != NULL && coml_table_array_at(a, 1)->tables == NULL);
+    coml_free(coml);
+
+    // Cloning only reads the document, its formatting is kept
+    const char commented[] = "# comment\nport = 1 # keep\n";
+    coml = coml_parse_ex(commented, sizeof(commented)-1, &options, NULL);
+    CHECK(coml != NULL);
+    if (coml == NULL) return;
+
+    coml_free(coml_clone(coml));
+    CHECK(coml_set_int(coml, 2, NULL, "port"));
+    CHECK(coml_write_file(coml, path));
+    read_file(path, written, sizeof(written));
+    CHECK(strcmp(written, "# comment\nport = 2 # keep\n") == 0);
+    coml_free(coml);
+
+    remove(path);
+}
+
+static size_t read_stream(FILE* file, char* buffer, size_t size) {
+    rewind(file);
+    size_t length = fread(buffer, 1, size-1, file);
+    buffer[length] = '\0';
+
+    return length;
+}
+
+// Reopened tables can't be streamed, they go through the tree
+static void test_json_split_tables(void) {
+    const char* documents[] = {
+        "[tool.a]\nx = 1\n[x]\ny = 2\n[tool.b]\nz = 3\n",
+        "[t]\nx.y = 1\nz = 2\nx.w = 3\n",
+    };
+    const char* expected[] = {
+        "{\"tool\":{\"a\":{\"x\":1},\"b\":{\"z\":3}},\"x\":{\"y\":2}}\n",
+        "{\"t\":{\"z\":2,\"x\":{\"y\":1,\"w\":3}}}\n",
+    };
+    char written[256];
+
+    for (size_t i = 0; i < sizeof(documents)/sizeof(documents[0]); ++i) {
+        FILE* output = tmpfile();
+        CHECK(output != NULL);
+        if (output == NULL) return;
+
+        Coml_Error error;
+        CHECK(!coml_toml_to_json(documents[i], strlen(documents[i]), output, NULL, &error));
+        CHECK(error.code == ComlError_Unsupported);
+        size_t length = read_stream(output, written, sizeof(written));
+        CHECK(length > 0 && written[length-1] != '\n'); // Left open, not closed as if it was complete
+
+        fclose(output);
+
+        output = tmpfile();
+        Coml* coml = coml_parse_ex(documents[i], strlen(documents[i]), NULL, NULL);
+        CHECK(output != NULL && coml != NULL);
+        if (output == NULL || coml == NULL) return;
+
+        CHECK(coml_write_json(coml, output));
+        read_stream(output, written, sizeof(written));
+        CHECK(strcmp(written, expected[i]) == 0);
+
+        coml_free(coml);
+        fclose(output);
+    }
+
+    // Streaming still gives the same output when tables are in one place
+    const char data[] = "a = \"x\"\n[t]\nl = [ 1, 2.5 ]\n[[e]]\nb = true\n[[e]]\n";
+    FILE* output = tmpfile();
+    CHECK(output != NULL);
+    if (output == NULL) return;
+
+    CHECK(coml_toml_to_json(data, sizeof(data)-1, output, NULL, NULL));
+    read_stream(output, written, sizeof(written));
+    CHECK(strcmp(written, "{\"a\":\"x\",\"t\":{\"l\":[1,2.5]},\"e\":[{\"b\":true},{}]}\n") == 0);
+    fclose(output);
+
+    // Writes to a full disk fail with their own code, not as a parse error
+    output = fopen("/dev/full", "wb");
+    if (output != NULL) {
+        Coml_Error error;
+        CHECK(!coml_toml_to_json(data, sizeof(data)-1, output, NULL, &error));
+        CHECK(error.code == ComlError_WriteFailed);
+
+        Coml* coml = coml_parse_ex(data, sizeof(data)-1, NULL, NULL);
+        CHECK(coml != NULL && !coml_write_json(coml, output));
+        coml_free(coml);
+        fclose(output);
+    }
+}
+
+// The tree parser rejects the same dotted keys as the streaming converter
+static void test_dotted_keys(void) {
+    const char* invalid[] = {
+        "a.b.c = 1\n[a.b]\n",
+        "a.b.c = 1\n[a]\n",
+        "[a]\nb.c = 1\n[a.b]\n",
+        "[[a]]\nb.c = 1\n[a.b]\n",
+        "[[a.arr]]\n[a]\narr.x = 1\n",
+        "[a.b]\nx = 1\n[a]\nb.y = 2\n",
+    };
+    const char* valid[] = {
+        "a.b.c = 1\na.b.d = 2\n",
+        "[fruit]\napple.color = 'red'\n[fruit.apple.texture]\nsmooth = true\n",
+        "[a.b.c]\n[a]\nx = 1\n",
+    };
+
+    for (size_t i = 0; i < sizeof(invalid)/sizeof(invalid[0]); ++i) {
+        Coml_Error error;
+        Coml* coml = coml_parse_ex(invalid[i], strlen(invalid[i]), NULL, &error);
+        CHECK(coml == NULL && error.code == ComlError_DuplicateKey);
+        coml_free(coml);
+    }
+
+    for (size_t i = 0; i < sizeof(valid)/sizeof(valid[0]); ++i) {
+        Coml* coml = coml_parse_ex(valid[i], strlen(valid[i]), NULL, NULL);
+        CHECK(coml != NULL);
+        coml_free(coml);
+    }
+}
+
+// Bodies over the limit can still decode to a string that fits
+static void test_string_limits(void) {
+    Coml_Limits limits = { 0, 0, 0, 0, 4, 0 };
+    Coml_Options options = { NULL, false, &limits };
+    const char* fits[] = { "a = 'abcd'\n", "a = \"\\u0041\\u0042\\u0043\\u0044\"\n", "\"\\u0041\\u0042\\u0043\\u0044\" = 1\n" };
+    const char* over[] = { "a = 'abcde'\n", "a = \"\\u0041\\u0042\\u0043\\u0044\\u0045\"\n", "\"\\u0041\\u0042\\u0043\\u0044\\u0045\" = 1\n" };
+
+    for (size_t i = 0; i < sizeof(fits)/sizeof(fits[0]); ++i) {
+        Coml_Error error;
+        Coml* coml = coml_parse_ex(fits[i], strlen(fits[i]), &options, &error);
+        CHECK(coml != NULL);
+        coml_free(coml);
+
+        coml = coml_parse_ex(over[i], strlen(over[i]), &options, &error);
+        CHECK(coml == NULL && error.code == ComlError_LimitExceeded);
+        coml_free(coml);
+    }
+
+    const char json[] = "{\"a\":\"\\u0041\\u0042\\u0043\\u0044\"}";
+    Coml* coml = coml_from_json(json, sizeof(json)-1, &options, NULL);
+    CHECK(coml != NULL);
+    coml_free(coml);
+}
+
+typedef struct {
+    int port;
+    const char* host;
+    double ratio;
+    bool debug;
+    int workers;
+    float scale;
+    int depth;
+} Bind_Server;
+
+#define BIND_SERVER_FIELDS(X) \
+    X(Bind_Server, port, "server", "port", INT, true, 1) \
+    X(Bind_Server, host, "server", "host", STRING, false, "localhost") \
+    X(Bind_Server, ratio, "", "ratio", DOUBLE, true, 0.25) \
+    X(Bind_Server, debug, "server", "debug", BOOL, false, true) \
+    X(Bind_Server, workers, "server", "workers", INT, true, 4) \
+    X(Bind_Server, scale, "server", "scale", FLOAT, true, 2) \
+    X(Bind_Server, depth, "a.b", "depth", INT, false, 0)
+COML_SCHEMA(bind_server_schema, BIND_SERVER_FIELDS);
+
+static void test_bind(void) {
+    const char data[] =
+        "ratio = 0.5\n"
+        "[server]\n"
+        "port = 8080\n"
+        "scale = 'big'\n"
+        "[a.b]\n"
+        "depth = 3\n";
+    Coml* coml = coml_parse_ex(data, sizeof(data)-1, NULL, NULL);
+    CHECK(coml != NULL);
+    if (coml == NULL) return;
+
+    // Bound, defaulted, missing and mistyped fields, issues in schema order
+    Bind_Server server;
+    Coml_Bind_Issue issues[4];
+    size_t count = coml_bind(coml, &bind_server_schema, &server, issues, 4);
+    CHECK(count == 2);
+    CHECK(server.port == 8080 && server.ratio == 0.5 && server.depth == 3);
+    CHECK(strcmp(server.host, "localhost") == 0 && server.debug);
+    CHECK(server.workers == 4 && server.scale == 2.0f);
+    CHECK(issues[0].kind == ComlBindIssue_Missing && strcmp(issues[0].field->key, "workers") == 0);
+    CHECK(issues[1].kind == ComlBindIssue_Mistyped && strcmp(issues[1].field->key, "scale") == 0);
+
+    // The count goes on past max_issues, only the first ones are stored
+    issues[1].field = NULL;
+    CHECK(coml_bind(coml, &bind_server_schema, &server, issues, 1) == 2);
+    CHECK(strcmp(issues[0].field->key, "workers") == 0 && issues[1].field == NULL);
+    CHECK(coml_bind(coml, &bind_server_schema, &server, NULL, 0) == 2);
+
+    // Without a document every required field is missing
+    CHECK(coml_bind(NULL, &bind_server_schema, &server, issues, 4) == 4);
+    CHECK(server.port == 1 && server.ratio == 0.25);
+
+    coml_free(coml);
+
+    // More fields than fit on the stack, with and without a document
+    enum { WIDE_LENGTH = 100 };
+    static Coml_Field wide_fields[WIDE_LENGTH];
+    static size_t wide_slots[2*WIDE_LENGTH], wide_displacements[WIDE_LENGTH];
+    static char wide_keys[WIDE_LENGTH][8];
+    int wide[WIDE_LENGTH];
+    for (size_t i = 0; i < WIDE_LENGTH; ++i) {
+        snprintf(wide_keys[i], sizeof(wide_keys[i]), "k%zu", i);
+        Coml_Field field = { "", wide_keys[i], ComlBind_Int, i*sizeof(int), i%2 == 0, (double)i, false, NULL, 0 };
+        wide_fields[i] = field;
+    }
+    Coml_Schema wide_schema = { wide_fields, WIDE_LENGTH, wide_slots, wide_displacements, false, false };
+
+    const char wide_data[] = "k0 = 7\nk99 = 'x'\n";
+    coml = coml_parse_ex(wide_data, sizeof(wide_data)-1, NULL, NULL);
+    CHECK(coml != NULL);
+    CHECK(coml_bind(coml, &wide_schema, wide, NULL, 0) == WIDE_LENGTH/2);
+    CHECK(wide[0] == 7 && wide[1] == 1 && wide[99] == 99);
+    CHECK(coml_bind(NULL, &wide_schema, wide, NULL, 0) == WIDE_LENGTH/2);
+    CHECK(wide[0] == 0);
+    coml_free(coml);
+}
+
+// Matches of pattern joined with spaces, tables as [name] and entries as []
+static void query_matches(Coml* coml, const char* pattern, char* out, size_t size) {
+    Coml_Query query;
+    out[0] = '\0';
+    if (!coml_query(coml, pattern, &query)) {
+        snprintf(out, size, "invalid");
+        return;
+    }
+
+    size_t length = 0;
+    while (coml_query_next(&query) && length < size) {
+        if (query.kv != NULL) length += snprintf(out+length, size-length, length == 0 ? "%s=%g" : " %s=%g", query.kv->key, *(double*)query.kv->value);
+        else length += snprintf(out+length, size-length, length == 0 ? "[%s]" : " [%s]", query.table->name != NULL ? query.table->name : "");
+    }
+    coml_query_free(&query);
+}
+
+static void test_query(void) {
+    const char data[] =
+        "timeout = 1\n"
+        "[servers.beta]\n"
+        "timeout = 20\n"
+        "[servers.alpha]\n"
+        "timeout = 10\n"
+        "[servers.alpha.pool]\n"
+        "timeout = 15\n"
+        "[web_one]\n"
+        "port = 1\n"
+        "[web_two]\n"
+        "port = 2\n"
+        "[[backend]]\n"
+        "timeout = 100\n"
+        "[[backend]]\n"
+        "timeout = 200\n"
+        "[backend.pool]\n"
+        "timeout = 250\n";
+    char matches[256];
+
+    Coml* coml = coml_parse_ex(data, sizeof(data)-1, NULL, NULL);
+    CHECK(coml != NULL);
+    if (coml == NULL) return;
+
+    // Document order, not the order of the index
+    query_matches(coml, "servers.*.timeout", matches, sizeof(matches));
+    CHECK(strcmp(matches, "timeout=20 timeout=10") == 0);
+    query_matches(coml, "servers.*", matches, sizeof(matches));
+    CHECK(strcmp(matches, "[beta] [alpha]") == 0);
+
+    // Entries match the name of the array, once each
+    query_matches(coml, "backend.timeout", matches, sizeof(matches));
+    CHECK(strcmp(matches, "timeout=100 timeout=200") == 0);
+    query_matches(coml, "backend", matches, sizeof(matches));
+    CHECK(strcmp(matches, "[] []") == 0);
+    query_matches(coml, "backend.*.timeout", matches, sizeof(matches));
+    CHECK(strcmp(matches, "timeout=250") == 0);
+
+    query_matches(coml, "**.timeout", matches, sizeof(matches));
+    CHECK(strcmp(matches, "timeout=1 timeout=20 timeout=10 timeout=15 timeout=100 timeout=200 timeout=250") == 0);
+    query_matches(coml, "**.pool", matches, sizeof(matches));
+    CHECK(strcmp(matches, "[pool] [pool]") == 0);
+    query_matches(coml, "servers.**.timeout", matches, sizeof(matches));
+    CHECK(strcmp(matches, "timeout=20 timeout=10 timeout=15") == 0);
+
+    query_matches(coml, "web_*", matches, sizeof(matches));
+    CHECK(strcmp(matches, "[web_one] [web_two]") == 0);
+    query_matches(coml, "web_*.p*", matches, sizeof(matches));
+    CHECK(strcmp(matches, "port=1 port=2") == 0);
+    query_matches(coml, "*_two.port", matches, sizeof(matches));
+    CHECK(strcmp(matches, "port=2") == 0);
+
+    query_matches(coml, "nope.*", matches, sizeof(matches));
+    CHECK(strcmp(matches, "") == 0);
+    query_matches(coml, "a..b", matches, sizeof(matches));
+    CHECK(strcmp(matches, "invalid") == 0);
+    query_matches(coml, "a.", matches, sizeof(matches));
+    CHECK(strcmp(matches, "invalid") == 0);
+
+    coml_free(coml);
+}
+
+static void test_image(void) {
+    const char data[] =
+        "title = \"x\"\n"
+        "[server]\n"
+        "port = 8080\n"
+        "ratio = 0.5\n"
+        "debug = true\n"
+        "weights = [ 1, 2.5 ]\n"
+        "hosts = [ \"a\", \"bc\" ]\n"
+        "[server.tls]\n"
+        "cert = \"c.pem\"\n"
+        "[[backend]]\n"
+        "timeout = 5\n"
+        "[[backend]]\n"
+        "timeout = 7\n"
+        "[backend.pool]\n"
+        "size = 3\n";
+
+    Coml* coml = coml_parse_ex(data, sizeof(data)-1, NULL, NULL);
+    CHECK(coml != NULL);
+    if (coml == NULL) return;
+
+    size_t size = coml_image_size(coml);
+    double* buffer = (double*)malloc(size);
+    CHECK(size > 0 && buffer != NULL && coml_image_write(coml, buffer, size));
+    coml_free(coml);
+
+    Coml_Image image;
+    CHECK(coml_image_open(&image, buffer, size));
+
+    CHECK(strcmp(coml_image_get_value_string(&image, NULL, "title"), "x") == 0);
+    CHECK(coml_image_get_value_int(&image, "server", "port") == 8080);
+    CHECK(coml_image_get_value_float(&image, "server", "ratio") == 0.5f);
+    CHECK(coml_image_get_value_bool(&image, "server", "debug"));
+    CHECK(coml_image_get_list_length(&image, "server", "weights") == 2);
+    CHECK(coml_image_get_value_list_double(&image, "server", "weights")[1] == 2.5);
+    CHECK(coml_image_get_list_length(&image, "server", "hosts") == 2);
+    CHECK(strcmp(coml_image_get_list_string_at(&image, "server", "hosts", 1), "bc") == 0);
+    CHECK(coml_image_get_list_string_at(&image, "server", "hosts", 2) == NULL);
+    CHECK(strcmp(coml_image_get_value_string(&image, "server.tls", "cert"), "c.pem") == 0);
+    CHECK(coml_image_get_value_int(&image, "backend", "timeout") == 0);
+
+    CHECK(strcmp(coml_image_find_value_string(&image, "cert"), "c.pem") == 0);
+    CHECK(coml_image_find_value_int(&image, "timeout") == 5);
+    CHECK(coml_image_find_value_int(&image, "size") == 3);
+    CHECK(strcmp(coml_image_find_list_string_at(&image, "hosts", 0), "a") == 0);
+    CHECK(coml_image_find_value_raw(&image, ComlType_String, "port") == NULL);
+
+    Coml_Image entry;
+    CHECK(coml_image_table_array_len(&image, "backend") == 2);
+    CHECK(coml_image_table_array_len(&image, "server") == 0);
+    CHECK(coml_image_table_array_at(&image, "backend", 1, &entry));
+    CHECK(coml_image_get_value_int(&entry, NULL, "timeout") == 7);
+    CHECK(coml_image_get_value_int(&entry, "pool", "size") == 3);
+    CHECK(coml_image_table_array_at(&image, "backend", 0, &entry));
+    CHECK(coml_image_find_value_int(&entry, "size") == 0);
+    CHECK(!coml_image_table_array_at(&image, "backend", 2, &entry));
+
+    free(buffer);
+}
+
+int main(void) {
+    test_shared_tables();
+    test_spliced_write();
+    test_json_split_tables();
+    test_dotted_keys();
+    test_string_limits();
+    test_bind();
+    test_query();
+    test_image();
+
+    if (failures != 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("All checks passed\n");
+
+    return 0;
+}